@@ -3,8 +3,8 @@
 #include <cstdio>
 #include <cstdlib>
 #include <vector>
-#include <string>
 #include <unordered_map>
+#include <string>
 #include <format>
 #include <algorithm>
 #include <ctime>
@@ -28,6 +28,7 @@ void usage() {
       "\t-f <n>\tOperate on a file with the given name\n"
       "\t-d\tDump extent descriptors\n"
       "\t-r\tRecurse into metablocks\n"
+      "\t-s\tRead zones from single-file LUN images (e.g. 52.lun)\n"
       ;
 }
 
@@ -85,8 +86,11 @@ typedef std::vector<uint64_t> Block;
 typedef std::pair<Block, uint64_t> Extent;
 
 class Analyzer {
-    std::unordered_map<std::string, Page*> DiskImage;
-    bool verbose;
+    // Zone images indexed by LUN and zone, filled on first access
+    std::vector<Page*> DiskImage[0100];
+    // Slots of the extent handles in a zone by extent id, built on first use
+    std::unordered_map<const Page*, std::vector<uint16_t>> slotIndex;
+    bool verbose, lun_files;
     uint64_t arch, dbdesc, DBkey, dblen, IOpat;
     const uint64_t * freeSpace;
     Block root;
@@ -104,7 +108,8 @@ class Analyzer {
     Extent find(uint64_t key);
 
 public:
-    Analyzer(uint64_t key, int lun, int start, int len, bool v) : verbose(v) {
+    Analyzer(uint64_t key, int lun, int start, int len, bool v, bool s) :
+        verbose(v), lun_files(s) {
        dbdesc = arch = to_lnuzzzz(lun, start, len);
        DBkey = key;
        setctl(dbdesc);
@@ -141,26 +146,37 @@ void Analyzer::setctl(uint64_t location) {
 }
 
 pp Analyzer::IOcall(uint64_t is) {
-    std::string nuzzzz;
-    nuzzzz = std::format("{:06o}", is & BITS(18));
+    auto & lun = DiskImage[(is >> 12) & 077];
+    if (lun.empty())
+        lun.resize(04000);
+    Page * &page = lun[is & 07777];
     // read only operation
-    auto it = DiskImage.find(nuzzzz);
     if (verbose)
-        std::cerr << std::format("Reading {}\n", nuzzzz);
-    if (it == DiskImage.end()) {
-        FILE * f = fopen(nuzzzz.c_str(), "r");
+        std::cerr << std::format("Reading {:06o}\n", is & BITS(18));
+    if (!page) {
+        std::string nuzzzz = std::format("{:06o}", is & BITS(18));
+        FILE * f;
+        if (lun_files) {
+            // All zones of a LUN are in one file
+            f = fopen(std::format("{:02o}.lun", (is >> 12) & 077).c_str(), "r");
+            if (f && fseek(f, (is & 07777) * sizeof(Page), SEEK_SET) < 0) {
+                fclose(f);
+                f = nullptr;
+            }
+        } else
+            f = fopen(nuzzzz.c_str(), "r");
         if (!f) {
             std::cerr << "\tZone " << nuzzzz << " does not exist yet\n";
-            DiskImage[nuzzzz] = new Page();  // create default
-            return *DiskImage[nuzzzz];
+            page = new Page();  // create default
+            return *page;
         }
         if (verbose)
             std::cerr << "\tFirst time - reading from disk\n";
-        DiskImage[nuzzzz] = new Page;
-        fread(DiskImage[nuzzzz], 1, sizeof(Page), f);
+        page = new Page;
+        fread(page, 1, sizeof(Page), f);
         fclose(f);
     }
-    return *DiskImage[nuzzzz];
+    return *page;
 }
 
 // Takes the zone number as the argument,
@@ -188,10 +204,19 @@ Extent Analyzer::find_item(uint64_t id) {
         std::cerr << std::format("There are {:o} items\n", nrec);
     if (!nrec)
         throw Mars::ERR_NO_RECORD;
+    auto & slots = slotIndex[&page];
+    if (slots.empty()) {
+        slots.resize(01000);
+        for (unsigned i = std::min<unsigned>(nrec, 1022); i; --i)
+            slots[get_id(page.w[i+1]) & 0777] = i;
+    }
     if (nrec > recnum)
         nrec = recnum;
     uint64_t curExtent;
-    for (int i = nrec; ;) {
+    auto i = slots[recnum];
+    if (i && i <= nrec && get_id(page.w[i+1]) == recnum)
+        curExtent = page.w[i+1];
+    else for (i = nrec; ;) {
         curExtent = page.w[i+1];
         if (get_id(curExtent) == recnum)
             break;
@@ -347,7 +372,8 @@ Analyzer * Analyzer::open(const std::string & fname) {
     }
     int length = fdescr[1] >> 18;
     int location = fdescr[1] & 0777777;
-    auto an = new Analyzer(fdescr[2], location >> 12, location & 07777, length, verbose);
+    auto an = new Analyzer(fdescr[2], location >> 12, location & 07777, length,
+                           verbose, lun_files);
     an->check_leaks();
     return an;
 }
@@ -388,9 +414,10 @@ int main(int argc, char ** argv) {
     bool verbose = false;
     bool dump_descrs = false;
     bool recurse = false;
+    bool lun_files = false;
     int catalog_len = 1;
     for (;;) {
-        c = getopt (argc, argv, "hVdrL:f:");
+        c = getopt (argc, argv, "hVdrsL:f:");
         if (c < 0)
             break;
         switch (c) {
@@ -407,6 +434,9 @@ int main(int argc, char ** argv) {
         case 'r':
             recurse = true;
             break;
+        case 's':
+            lun_files = true;
+            break;
         case 'L':
             catalog_len = strtol(optarg, nullptr, 8);
             break;
@@ -416,7 +446,7 @@ int main(int argc, char ** argv) {
         }
     }
 
-    Analyzer an(ROOTKEY, 052, 0, catalog_len, verbose);
+    Analyzer an(ROOTKEY, 052, 0, catalog_len, verbose, lun_files);
     an.avail();
     an.check_leaks();
     an.dir();
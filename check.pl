@@ -1,13 +1,30 @@
 #!/usr/bin/env perl
-die "Usage: check.pl <N zones (oct)>\n" unless $#ARGV == 0;
+die "Usage: check.pl <N zones (oct)> [combined dump file]\n" unless $#ARGV == 0 || $#ARGV == 1;
 $nzon = oct($ARGV[0]);
 chomp(@gold = `besmtool dump 1234 --start=0 --length=$nzon | cut -b 1-31 | grep -v Zone`);
 
+if ($#ARGV == 1) {
+# The later lines for a word supersede the earlier ones
+open(F, $ARGV[1]) || die "$ARGV[1] does not exist\n";
+while (<F>) {
+chomp;
+$silver{$1} = $_ if /^([0-7]{4}\.[0-7]{4}):/;
+}
+close(F);
+}
+
 for ($z = 0; $z < $nzon; ++$z) {
+if (!%silver) {
 $fname = sprintf('52%04o.txt', $z);
 open(F, $fname) || die "$fname does not exist\n";
+}
 for ($i = 0; $i < 1024; ++$i) {
+if (%silver) {
+$word = $silver{sprintf('%04o.%04o', $z, $i)};
+die sprintf("Zone %04o is not in $ARGV[1]\n", $z) unless defined $word;
+} else {
 chomp ($word = <F>);
+}
 next if $word =~ /1234 5670 0765 4321/;
 $good = $gold[$z*1024+$i];
 print "$good <- gold silver -> $word\n" unless $good eq $word;
@@ -3,13 +3,24 @@
 #include <iostream>
 #include <cstdlib>
 #include <cassert>
+#include <array>
+#include <bit>
+#include <bitset>
+#include <deque>
 #include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <vector>
 #include <string>
 #include <format>
 #include <algorithm>
 #include <chrono>
 #include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "mars.h"
 
@@ -22,6 +33,8 @@ using Error = Mars::Error;
 #define ROOT_METABLOCK 02000    // ID 1 in zone 0
 #define LOCKKEY ONEBIT(32)
 #define META_SIZE (2*16+1)
+#define WIDE_FANOUT 0200        // keys in a half-full wide metablock
+#define LUN_ZONES 04000         // the zone field of an I/O word is 12 bits
 
 // Field offsets of interest within BDVECT
 static const std::vector<int> comparable{
@@ -44,18 +57,237 @@ void Mars::dump() {
 #define BITS(n)   (~0ULL >> (64 - n)) // bitmask of n bits from LSB
 
 struct Page {
-    Page() { }
-    Page(uint64_t * page) {
-        for (int i = 0; i < 1024; ++i)
-            w[i] = page[i];
+    uint64_t w[1024];
+};
+
+// Keeps the zone images in memory, indexed by LUN and zone;
+// the zone arrays of a LUN are allocated on first access
+struct MemoryBackend : Mars::Backend {
+    std::unique_ptr<std::unique_ptr<Page>[]> images[0100];
+    std::unique_ptr<Page> & image(unsigned addr) {
+        auto & lun = images[(addr >> 12) & 077];
+        if (!lun)
+            lun = std::make_unique<std::unique_ptr<Page>[]>(LUN_ZONES);
+        return lun[addr & 07777];
     }
-    void to_memory(uint64_t * page) {
-        for (int i = 0; i < 1024; ++i)
-            page[i] = w[i];
+    uint64_t * read(unsigned addr) override {
+        auto & page = image(addr);
+        return page ? page->w : nullptr;
+    }
+    uint64_t * write(unsigned addr) override {
+        auto & page = image(addr);
+        if (!page)
+            page = std::make_unique<Page>();
+        return page->w;
+    }
+    void remove(unsigned addr) override {
+        image(addr).reset();
+    }
+    void flush(unsigned, bool) override { }
+};
+
+// Caches the zone files in memory, reading them on first access.
+// The zones to prefetch are read by a background thread; the zone
+// table is shared with it, but the files are read outside of the lock.
+struct ZoneFileBackend : MemoryBackend {
+    const bool & verbose;
+    std::mutex mutex;           // of the zone table and the queue
+    std::condition_variable wanted;
+    std::deque<unsigned> queue;
+    std::thread prefetcher;
+    bool done = false;
+    ZoneFileBackend(const bool & v) : verbose(v) { }
+    ~ZoneFileBackend() {
+        if (prefetcher.joinable()) {
+            {
+                std::lock_guard<std::mutex> g(mutex);
+                done = true;
+            }
+            wanted.notify_one();
+            prefetcher.join();
+        }
+    }
+    static std::unique_ptr<Page> load(unsigned addr) {
+        std::ifstream f(std::format("{:06o}", addr));
+        if (!f)
+            return nullptr;
+        auto page = std::make_unique<Page>();
+        f.read(reinterpret_cast<char*>(page.get()), sizeof(Page));
+        return page;
+    }
+    uint64_t * read(unsigned addr) override {
+        {
+            std::lock_guard<std::mutex> g(mutex);
+            if (auto & page = image(addr))
+                return page->w;
+        }
+        auto page = load(addr);
+        if (!page)
+            return nullptr;
+        if (verbose)
+            std::cerr << "\tFirst time - reading from disk\n";
+        std::lock_guard<std::mutex> g(mutex);
+        auto & slot = image(addr);
+        if (!slot)              // not prefetched meanwhile
+            slot = std::move(page);
+        return slot->w;
+    }
+    // A zone is changed in place, it must be read in first
+    uint64_t * write(unsigned addr) override {
+        if (uint64_t * page = read(addr))
+            return page;
+        std::lock_guard<std::mutex> g(mutex);
+        return MemoryBackend::write(addr);
+    }
+    void remove(unsigned addr) override {
+        std::lock_guard<std::mutex> g(mutex);
+        MemoryBackend::remove(addr);
+    }
+    void flush(unsigned addr, bool sync) override;
+    void prefetch(unsigned addr) override {
+        std::lock_guard<std::mutex> g(mutex);
+        if (image(addr))
+            return;
+        queue.push_back(addr);
+        if (!prefetcher.joinable())
+            prefetcher = std::thread(&ZoneFileBackend::run, this);
+        wanted.notify_one();
+    }
+    void run();
+};
+
+// The zone is written to a new file replacing the old one, so that
+// a crash leaves either of them whole; with 'sync', the renaming
+// is made durable as well.
+void ZoneFileBackend::flush(unsigned addr, bool sync) {
+    std::string nuzzzz = std::format("{:06o}", addr);
+    std::string tmp = nuzzzz + ".new";
+    const uint64_t * w = read(addr);
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0 || ::write(fd, w, sizeof(Page)) != sizeof(Page) ||
+        (sync && fdatasync(fd) < 0) || close(fd) < 0 ||
+        rename(tmp.c_str(), nuzzzz.c_str()) < 0) {
+        std::cerr << std::format("Could not write {} ({})\n", nuzzzz, strerror(errno));
+        exit(1);
+    }
+    if (sync) {
+        int dir = open(".", O_RDONLY | O_DIRECTORY);
+        if (dir < 0 || fsync(dir) < 0) {
+            std::cerr << std::format("Could not sync the directory of {} ({})\n", nuzzzz, strerror(errno));
+            exit(1);
+        }
+        close(dir);
+    }
+}
+
+// The prefetching thread
+void ZoneFileBackend::run() {
+    std::unique_lock<std::mutex> g(mutex);
+    for (;;) {
+        wanted.wait(g, [this] { return done || !queue.empty(); });
+        if (done)
+            return;
+        unsigned addr = queue.front();
+        queue.pop_front();
+        if (image(addr))
+            continue;
+        g.unlock();
+        auto page = load(addr);
+        g.lock();
+        auto & slot = image(addr);
+        if (page && !slot)
+            slot = std::move(page);
+    }
+}
+
+// Maps the file of a LUN on first access. A persistent file is extended
+// to LUN_ZONES zones, and the zones never written read as zeros, that is,
+// as non-existent. The mapping is private: the changes reach the file
+// only when a zone is flushed, so that the kernel never writes out
+// the zones of a transaction or a call that is not complete.
+// A non-persistent Mars never writes to the file.
+struct LunFileBackend : Mars::Backend {
+    const bool persistent;
+    uint64_t * images[0100] = {};
+    int fds[0100];
+    LunFileBackend(bool p) : persistent(p) { std::fill_n(fds, 0100, -1); }
+    ~LunFileBackend() {
+        for (auto image : images) {
+            if (image)
+                munmap(image, LUN_ZONES * sizeof(Page));
+        }
+        for (int fd : fds) {
+            if (fd >= 0)
+                close(fd);
+        }
+    }
+    uint64_t * map(unsigned addr);
+    uint64_t * read(unsigned addr) override {
+        uint64_t * zone = map(addr);
+        return zone[0] ? zone : nullptr;
+    }
+    uint64_t * write(unsigned addr) override {
+        return map(addr);
+    }
+    void remove(unsigned addr) override {
+        uint64_t * zone = map(addr);
+        std::fill(zone, zone+1024, 0);
+    }
+    void flush(unsigned addr, bool) override {
+        const uint64_t * zone = map(addr);
+        int fd = fds[(addr >> 12) & 077];
+        if (pwrite(fd, zone, sizeof(Page), (addr & 07777) * sizeof(Page)) != sizeof(Page) ||
+            fdatasync(fd) < 0) {
+            std::cerr << std::format("Could not write {:06o} ({})\n", addr, strerror(errno));
+            exit(1);
+        }
+    }
+    void prefetch(unsigned addr) override {
+        // The kernel reads the pages in asynchronously
+        madvise(map(addr), sizeof(Page), MADV_WILLNEED);
     }
-    uint64_t w[1024];
 };
 
+uint64_t * LunFileBackend::map(unsigned addr) {
+    unsigned lun = (addr >> 12) & 077;
+    uint64_t * &image = images[lun];
+    if (image)
+        return image + (addr & 07777) * 1024;
+    const size_t size = LUN_ZONES * sizeof(Page);
+    std::string name = std::format("{:02o}.lun", lun);
+    struct stat st;
+    void * mem;
+    if (persistent) {
+        int fd = open(name.c_str(), O_RDWR | O_CREAT, 0666);
+        if (fd < 0 || fstat(fd, &st) < 0 ||
+            (st.st_size < off_t(size) && ftruncate(fd, size) < 0)) {
+            std::cerr << std::format("Could not open {} ({})\n", name, strerror(errno));
+            exit(1);
+        }
+        mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        fds[lun] = fd;
+    } else {
+        int fd = open(name.c_str(), O_RDONLY);
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= off_t(size)) {
+            mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        } else {
+            mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            // A short file, if any, is read in
+            if (fd >= 0 && mem != MAP_FAILED && pread(fd, mem, size, 0) < 0)
+                mem = MAP_FAILED;
+        }
+        if (fd >= 0)
+            close(fd);
+    }
+    if (mem == MAP_FAILED) {
+        std::cerr << std::format("Could not map {} ({})\n", name, strerror(errno));
+        exit(1);
+    }
+    image = static_cast<uint64_t*>(mem);
+    return image + (addr & 07777) * 1024;
+}
+
 struct MarsImpl {
     typedef uint64_t &uintref;
     typedef uint64_t* &puintref;
@@ -118,6 +350,20 @@ struct MarsImpl {
 
     uint64_t bufpage[1024], tabpage[1024];
 
+    // A page frame of the buffer pool; the data zones are accessed
+    // in place, within their cached images
+    struct Frame {
+        uint64_t addr;          // I/O address of the zone, or NOZONE
+        bool dirty, referenced;
+        uint64_t * w;
+        uint16_t * slots;       // the slot index of the zone
+    };
+    static const uint64_t NOZONE = ~0ULL;
+    std::vector<Frame> pool;
+    Frame * curFrame = nullptr; // the frame of the current data zone
+    uint16_t * curSlots;        // the slot index of the current zone
+    size_t hand = 0;            // of the CLOCK
+
     // Fields of BDVECT
 
     puintref myloc, bdbuf, bdtab, curbuf, freeSpace, extPtr;
@@ -143,12 +389,45 @@ struct MarsImpl {
     uint64_t cont;              // continuation instruction word
     CursorElt * const Cursor;
     Metablock * const RootBlock{reinterpret_cast<Metablock*>(mars.bdv.RootBlk+1)};
-    uint64_t * const Secondary{mars.bdv.SecBlk+1};
+    uint64_t * Secondary{mars.bdv.SecBlk+1};
+    // Keys in a half-full secondary metablock, the root holds as many
+    // at most; the secondary blocks of the wide format do not fit in SecBlk
+    unsigned fanout = 16;
+    std::vector<uint64_t> wideBlock;
 
     // Fields of BDSYS
     uint64_t arch;
     uint64_t *abdv;
-    std::unordered_map<std::string, Page> DiskImage;
+    // Stands for the zones that do not exist yet
+    Page absent;
+    // Slots of the extent handles in a zone by extent id, 0 if unknown,
+    // indexed like the zone images. An entry is only a hint, checked
+    // at each use, and stays valid as long as the zone is not changed
+    // by other means than handle_chunk() and free().
+    typedef std::array<uint16_t, 01000> SlotIndex;
+    std::unique_ptr<std::unique_ptr<SlotIndex>[]> SlotIndexes[0100];
+    // Segment tree of the maxima of the free space array of the current
+    // DB, leaves at [freeLeaves, freeLeaves + dblen), and the usable
+    // space in total; rebuilt on first use after the array has been
+    // re-read or moved.
+    std::vector<uint16_t> freeTree;
+    size_t freeLeaves = 0;
+    uint64_t freeUsable = 0;
+    const uint64_t * freeIndexed = nullptr;
+    // I/O addresses of the zones written since the last flush
+    std::vector<uint64_t> DirtyZones;
+    std::bitset<01000000> isDirty;
+    // Set between begin() and commit() or rollback()
+    bool transaction = false;
+    // Contents of the zones changed in the transaction as of begin(),
+    // empty for the zone files that did not exist then
+    std::vector<std::pair<uint64_t, std::unique_ptr<Page>>> Undo;
+    std::bitset<01000000> preserved;
+    // The redo log, if open, and its length in bytes
+    int logfd = -1;
+    size_t logSize = 0;
+    // Whether Mars::dump_file has been written to
+    bool dumpStarted = false;
 
     MarsImpl(Mars & up) :
         mars(up), verbose(up.verbose),
@@ -191,15 +470,83 @@ struct MarsImpl {
         erhndl(up.bdv.erhndl),
         Cursor(reinterpret_cast<CursorElt*>(up.bdv.Cursor))
 
-        { }
+        {
+            std::fill(absent.w, absent.w+1024, ARBITRARY_NONZERO);
+        }
+    ~MarsImpl();
     void IOflush();
     void IOcall(uint64_t, uint64_t *);
+    uint64_t * zone_page(uint64_t);
+    SlotIndex & slot_index(uint64_t);
+    void preserve(uint64_t);
+    // Whether the zones are preserved on their first access
+    bool tracking() const { return transaction || logfd >= 0; }
+    void forget_preserved();
+    uint64_t * write_page(uint64_t);
+    void open_log(), write_log(), checkpoint();
+    Error begin(), commit(), rollback();
+    Error bulk_load(std::span<const Mars::Record>);
+    void scan_step(Mars::Scan &);
+    // Where the defragmentation of the DB at defragDB is to continue
+    uint64_t defragDB = 0, defragKey = 0;
+    bool defrag(std::chrono::microseconds);
+    bool relocate();
+    // Bloom filters of the keys of the DBs by IOpat. The deleted keys
+    // remain; the filter is built again when it is overfull, or when
+    // the deleted keys are too many.
+    struct Bloom {
+        std::vector<uint64_t> bits;
+        unsigned hashes;
+        size_t capacity, keys = 0, deleted = 0;
+        Bloom(size_t n, unsigned bits_per_key) {
+            capacity = std::max<size_t>(2*n, 1024);
+            size_t nbits = std::bit_ceil(capacity * bits_per_key);
+            bits.assign(nbits / 64, 0);
+            hashes = std::clamp(bits_per_key * 69 / 100, 1u, 8u);
+        }
+        // Calls f with the bit numbers for the key, the high bits of
+        // the products: the low bits only depend on the low bits of the key
+        template<class F> bool probe(uint64_t key, F f) const {
+            unsigned shift = 64 - std::countr_zero(bits.size() * 64);
+            uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+            uint64_t h2 = key * 0xC2B2AE3D27D4EB4FULL | 1;
+            for (unsigned i = 0; i < hashes; ++i, h += h2)
+                if (!f(h >> shift))
+                    return false;
+            return true;
+        }
+        void add(uint64_t key) {
+            ++keys;
+            probe(key, [this](uint64_t b) { bits[b/64] |= 1ULL << b%64; return true; });
+        }
+        bool may_have(uint64_t key) const {
+            return probe(key, [this](uint64_t b) { return bits[b/64] >> b%64 & 1; });
+        }
+        bool stale() const { return keys > capacity || 2*deleted > keys; }
+    };
+    std::unordered_map<uint64_t, Bloom> filters;
+    void build_filter(), add_to_filter(uint64_t);
+    bool surely_absent(uint64_t);
+
+    // Counts the operations, for a scan to know if the cursor is intact
+    uint64_t generation = 0;
+    // The operation which has left the cursor at a leaf after an insert,
+    // the DB, the level and the handle of the leaf
+    uint64_t appendGeneration = 0, appendDB = 0, appendLevel = 0, appendLeaf = 0;
+    void load_records(std::span<const Mars::Record>);
+    void dump_txt_zones(std::vector<uint64_t>);
     void get_zone(uint64_t);
+    Frame & get_frame(uint64_t);
+    void drop_frames(bool);
+    void reset_pool();
     void save(bool);
     void finalize(const char *);
     ExtentHeader make_extent_header();
     uint64_t* make_metablock(uint64_t key);
     uint64_t usable_space();
+    void index_free(), set_free(unsigned, uint64_t);
+    int first_free(uint64_t, size_t = 0), last_free(uint64_t, size_t);
+    int fit_zone(uint64_t);
     uint64_t find_item(uint64_t);
     void info(uint64_t);
     void totext();
@@ -209,6 +556,8 @@ struct MarsImpl {
     void cpyout(uint64_t);
     void lock();
     void get_block(uint64_t, uint64_t*), get_root_block(), get_secondary_block(uint64_t);
+    void set_fanout(unsigned);
+    void prefetch(uint64_t);
     void free_from_current_extent(int);
     Metablock::Header get_block_header(uint64_t arg);
     uint64_t skip(Error);
@@ -238,6 +587,8 @@ struct MarsImpl {
     uint64_t update_btree(BtreeArgs = BtreeArgs());
     void add_key(uint64_t key, uint64_t toAdd, bool indirect);
     BtreeArgs del_key();
+    bool merge_block(bool first);
+    void collapse_root();
     void update_prev(uint64_t chain, uint64_t newHeader);
     void propagate_steps();
     void check_space(unsigned need);
@@ -246,6 +597,8 @@ struct MarsImpl {
     void search_in_block(Metablock*, uint64_t);
     void update(uint64_t, uint64_t *usrloc);
     void setDirty(int x) {
+        if (curZone && curFrame)
+            curFrame->dirty = true;
         dirty |= curZone ? x+1 : 1;
     }
     void set_dirty_data() {
@@ -264,6 +617,7 @@ struct MarsImpl {
     bool is_dirty_tab() const {
         return dirty & 1;
     }
+    // Some data frame is dirty
     bool is_dirty_buf() {
         return dirty & 2;
     }
@@ -274,8 +628,10 @@ Mars::Mars() : impl(*new MarsImpl(*this)) { }
 Mars::Mars(bool persistent) : impl(*new MarsImpl(*this)), flush(persistent) { }
 
 Mars::~Mars() {
+    if (impl.transaction)
+        impl.rollback();
     if (flush) {
-        impl.IOflush();
+        impl.checkpoint();
     }
     delete &impl;
 }
@@ -299,80 +655,339 @@ const char * msg[] = {
     "DB is locked", "No current record", "No prev. record", "No next record",
     "Wrong password" };
 
-void MarsImpl::IOflush() {
-    for (auto & it : DiskImage) {
-        const std::string& nuzzzz = it.first;
-        std::ofstream f(nuzzzz);
-        if (!f) {
-            std::cerr << std::format("Could not open {} ({})\n", nuzzzz, strerror(errno));
-            exit(1);
+MarsImpl::~MarsImpl() {
+    if (logfd >= 0)
+        close(logfd);
+}
+
+// Puts 'n' octal digits of 'v' at 'p'
+static inline void put_octal(char * p, uint64_t v, int n) {
+    while (n--) {
+        p[n] = '0' + (v & 7);
+        v >>= 3;
+    }
+}
+
+// Formats a zone as text, a line of 4 groups of 4 octal digits per word,
+// e.g. "0001.0000:  0000 0000 0000 0001"
+static std::string format_zone(unsigned addr, const uint64_t * w) {
+    std::string text;
+    text.reserve(1024 * 32);
+    char line[] = "zzzz.iiii:  aaaa bbbb cccc dddd\n";
+    put_octal(line, addr, 4);
+    for (int i = 0; i < 1024; ++i) {
+        if (w[i] >> 48) {
+            // Wider than a BESM-6 word, as ARBITRARY_NONZERO
+            text += std::format("{:04o}.{:04o}:  {:04o} {:04o} {:04o} {:04o}\n",
+                                addr & 07777, i, w[i] >> 36,
+                                (w[i] >> 24) & 07777,
+                                (w[i] >> 12) & 07777,
+                                (w[i] >> 0) & 07777);
+            continue;
         }
-        f.write(reinterpret_cast<char*>(&it.second), sizeof(Page));
-
-        if (mars.dump_txt_zones) {
-            std::string txt(nuzzzz+".txt");
-            std::ofstream t(txt);
-            if (!t) {
-                std::cerr << std::format("Could not open {} ({})\n", txt, strerror(errno));
-                exit(1);
+        put_octal(line+5, i, 4);
+        put_octal(line+12, w[i] >> 36, 4);
+        put_octal(line+17, w[i] >> 24, 4);
+        put_octal(line+22, w[i] >> 12, 4);
+        put_octal(line+27, w[i], 4);
+        text.append(line, 32);
+    }
+    return text;
+}
+
+static void write_text(const std::string & name, const std::string & text, int flags) {
+    int fd = open(name.c_str(), O_WRONLY | O_CREAT | flags, 0666);
+    if (fd < 0 || write(fd, text.data(), text.size()) != ssize_t(text.size())) {
+        std::cerr << std::format("Could not write {} ({})\n", name, strerror(errno));
+        exit(1);
+    }
+    close(fd);
+}
+
+// Writes the text dumps of the zones, formatting them in parallel,
+// either to a .txt file per zone or appending them to Mars::dump_file
+// in the order of I/O addresses.
+void MarsImpl::dump_txt_zones(std::vector<uint64_t> zones) {
+    std::sort(zones.begin(), zones.end());
+    std::vector<std::string> text(zones.size());
+    bool combined = !mars.dump_file.empty();
+    auto work = [&](size_t from, size_t step) {
+        for (size_t i = from; i < zones.size(); i += step) {
+            text[i] = format_zone(zones[i], mars.backend->read(zones[i]));
+            if (!combined) {
+                write_text(std::format("{:06o}.txt", zones[i]), text[i], O_TRUNC);
+                text[i].clear();
             }
-            const char * zone = nuzzzz.c_str()+2;
-            for (int i = 0; i < 1024; ++i) {
-                t << std::format("{}.{:04o}:  {:04o} {:04o} {:04o} {:04o}\n",
-                        zone, i, it.second.w[i] >> 36,
-                        (it.second.w[i] >> 24) & 07777,
-                        (it.second.w[i] >> 12) & 07777,
-                        (it.second.w[i] >> 0) & 07777);
+        }
+    };
+    // A thread per 16 zones at least
+    size_t threads = std::min<size_t>(std::thread::hardware_concurrency(), zones.size() / 16);
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads; ++t)
+        workers.emplace_back(work, t, threads);
+    work(0, std::max<size_t>(threads, 1));
+    for (auto & t : workers)
+        t.join();
+    if (combined) {
+        std::string all;
+        for (auto & t : text)
+            all += t;
+        // The file is started anew by each Mars
+        write_text(mars.dump_file, all, dumpStarted ? O_APPEND : O_TRUNC);
+        dumpStarted = true;
+    }
+}
+
+// Writes out the zones written to since the last flush
+void MarsImpl::IOflush() {
+    for (uint64_t addr : DirtyZones) {
+        isDirty[addr] = false;
+        // With the redo log, the zone must be on disk before the log is truncated
+        mars.backend->flush(addr, logfd >= 0);
+    }
+    if (mars.dump_txt_zones)
+        dump_txt_zones(DirtyZones);
+    DirtyZones.clear();
+}
+
+// Returns the cached image of a zone, reading it in on first access,
+// or the page of ARBITRARY_NONZERO words if the zone does not exist yet.
+uint64_t * MarsImpl::zone_page(uint64_t op) {
+    if (uint64_t * page = mars.backend->read(op & BITS(18)))
+        return page;
+    std::cerr << std::format("\tZone {:06o} does not exist yet\n", op & BITS(18));
+    return absent.w;
+}
+
+// Returns the slot index of the zone at the I/O address
+auto MarsImpl::slot_index(uint64_t addr) -> SlotIndex & {
+    auto & lun = SlotIndexes[(addr >> 12) & 077];
+    if (!lun)
+        lun = std::make_unique<std::unique_ptr<SlotIndex>[]>(LUN_ZONES);
+    auto & index = lun[addr & 07777];
+    if (!index)
+        index = std::make_unique<SlotIndex>();
+    return *index;
+}
+
+// Within a transaction, keeps a copy of the zone at the I/O address
+// before its first change, unless there is one already.
+void MarsImpl::preserve(uint64_t addr) {
+    addr &= BITS(18);
+    if (!tracking() || preserved[addr])
+        return;
+    preserved[addr] = true;
+    std::unique_ptr<Page> copy;
+    if (const uint64_t * page = mars.backend->read(addr)) {
+        copy = std::make_unique<Page>();
+        std::copy(page, page+1024, copy->w);
+    }
+    Undo.emplace_back(addr, std::move(copy));
+}
+
+// Drops the copies of the zones made by preserve(); the zones
+// will be copied again on their next access.
+void MarsImpl::forget_preserved() {
+    for (auto & u : Undo)
+        preserved[u.first] = false;
+    Undo.clear();
+    curFrame = nullptr;
+}
+
+static const uint64_t REDO_MAGIC = 0x5245444f00000000; // "REDO"
+
+static uint64_t checksum(const uint64_t * w, size_t len) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < len; ++i)
+        sum = (sum ^ w[i]) * 0x100000001b3;
+    return sum;
+}
+
+// Appends the words changed in the preserved zones to the redo log
+// as a record of {REDO_MAGIC, count, count x {addr << 10 | offset, value},
+// checksum}, and makes it durable. The zones are written out instead
+// if the log becomes too long.
+void MarsImpl::write_log() {
+    static const Page zeros{};
+    std::vector<uint64_t> rec{REDO_MAGIC, 0};
+    for (auto & [addr, copy] : Undo) {
+        const uint64_t * now = mars.backend->read(addr);
+        if (!now)
+            continue;
+        const uint64_t * old = copy ? copy->w : zeros.w;
+        for (int i = 0; i < 1024; ++i) {
+            if (now[i] != old[i]) {
+                rec.push_back(addr << 10 | i);
+                rec.push_back(now[i]);
             }
         }
     }
+    forget_preserved();
+    if (rec.size() == 2)
+        return;
+    rec[1] = (rec.size() - 2) / 2;
+    rec.push_back(checksum(rec.data(), rec.size()));
+    size_t bytes = rec.size() * sizeof(uint64_t);
+    if (write(logfd, rec.data(), bytes) != ssize_t(bytes) || fdatasync(logfd) < 0) {
+        std::cerr << std::format("Could not write {} ({})\n", mars.redo_log, strerror(errno));
+        exit(1);
+    }
+    logSize += bytes;
+    if (logSize > mars.log_limit)
+        checkpoint();
+}
+
+// Writes out the changed zones, making the redo log unnecessary
+void MarsImpl::checkpoint() {
+    IOflush();
+    if (logfd >= 0 && ftruncate(logfd, 0) < 0) {
+        std::cerr << std::format("Could not truncate {} ({})\n", mars.redo_log, strerror(errno));
+        exit(1);
+    }
+    logSize = 0;
 }
 
+// Opens the redo log of a persistent Mars if it is configured,
+// and applies the complete records found in it to the zones.
+void MarsImpl::open_log() {
+    if (logfd >= 0 || !mars.flush || mars.redo_log.empty())
+        return;
+    int fd = open(mars.redo_log.c_str(), O_RDWR | O_CREAT | O_APPEND, 0666);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        std::cerr << std::format("Could not open {} ({})\n", mars.redo_log, strerror(errno));
+        exit(1);
+    }
+    std::vector<uint64_t> log(st.st_size / sizeof(uint64_t));
+    if (pread(fd, log.data(), log.size() * sizeof(uint64_t), 0) < 0)
+        log.clear();
+    size_t pos = 0, records = 0;
+    while (pos + 3 <= log.size() && log[pos] == REDO_MAGIC) {
+        size_t end = pos + 2 + 2 * log[pos+1];
+        if (log[pos+1] > log.size() || end >= log.size() ||
+            checksum(&log[pos], end - pos) != log[end])
+            break;              // torn by the crash
+        for (pos += 2; pos < end; pos += 2)
+            write_page(log[pos] >> 10)[log[pos] & 01777] = log[pos+1];
+        pos = end + 1;
+        ++records;
+    }
+    if (verbose && records)
+        std::cerr << std::format("Replayed {} records of {}\n", records, mars.redo_log);
+    logfd = fd;
+    checkpoint();
+}
+
+// Transfers a zone between the cache and a buffer. The frames
+// of the pool are the cached images themselves; for them, a read
+// or a write only tells that the zone is in use or has been changed.
 void MarsImpl::IOcall(uint64_t op, uint64_t *buf) {
-    std::string nuzzzz;
-    nuzzzz = std::format("{:06o}", op & BITS(18));
     if (op & ONEBIT(40)) {
         // read
-        auto it = DiskImage.find(nuzzzz);
         if (verbose)
-            std::cerr << std::format("Reading {} to {}\n", nuzzzz,
-                                     buf == bdbuf ? "buf" : "tab");
-        if (it == DiskImage.end()) {
-            std::ifstream f(nuzzzz);
-            if (!f) {
-                std::cerr << "\tZone " << nuzzzz << " does not exist yet\n";
-                for (auto p = buf; p < buf+1024; ++p)
-                    *p = ARBITRARY_NONZERO;
-                return;
-            }
-            if (verbose)
-                std::cerr << "\tFirst time - reading from disk\n";
-            f.read(reinterpret_cast<char*>(&DiskImage[nuzzzz]), sizeof(Page));
-            DiskImage[nuzzzz].to_memory(buf);
-        } else
-            it->second.to_memory(buf);
-    } else {
-        // write
+            std::cerr << std::format("Reading {:06o} to {}\n", op & BITS(18),
+                                     buf == bdtab ? "tab" : "buf");
+        uint64_t * page = zone_page(op);
+        if (page != buf)
+            std::copy(page, page+1024, buf);
+        if (buf == bdtab)
+            freeIndexed = nullptr;
+        return;
+    }
+    // write
+    if (verbose)
+        std::cerr << std::format("Writing {:06o} from {}\n", op & BITS(18),
+                                 buf == bdtab ? "tab" : "buf");
+    uint64_t * page = write_page(op);
+    if (page != buf)
+        std::copy(buf, buf+1024, page);
+}
+
+// Returns the cached image of a zone to be written to,
+// marking the zone as written and creating the image if needed.
+uint64_t * MarsImpl::write_page(uint64_t op) {
+    preserve(op);
+    if (!isDirty[op & BITS(18)]) {
+        isDirty[op & BITS(18)] = true;
+        DirtyZones.push_back(op & BITS(18));
+    }
+    return mars.backend->write(op & BITS(18));
+}
+
+// Returns the frame referencing the cached image of the zone at the
+// I/O address. The frame to reuse is chosen by the CLOCK algorithm;
+// if it is dirty, its zone is marked as written first.
+auto MarsImpl::get_frame(uint64_t addr) -> Frame & {
+    if (pool.empty())
+        reset_pool();
+    for (auto & f : pool) {
+        if (f.addr == addr) {
+            f.referenced = true;
+            if (tracking())
+                preserve(addr);
+            return f;
+        }
+    }
+    for (;; hand = (hand + 1) % pool.size()) {
+        Frame & f = pool[hand];
+        if (f.referenced) {
+            f.referenced = false;
+            continue;
+        }
+        if (f.dirty)
+            IOcall(f.addr, f.w);
+        f.addr = addr;
+        f.dirty = false;
+        f.referenced = true;
+        f.slots = slot_index(addr).data();
         if (verbose)
-            std::cerr << std::format("Writing {} from {}\n", nuzzzz,
-                                     buf == bdbuf ? "buf" : "tab");
-        DiskImage[nuzzzz] = buf;
+            std::cerr << std::format("Reading {:06o} to buf\n", addr);
+        if (tracking())
+            preserve(addr);
+        f.w = zone_page(addr);
+        hand = (hand + 1) % pool.size();
+        return f;
     }
 }
 
+// Writes back the dirty data frames; if 'forget' is set,
+// also makes all frames empty, forcing the zones to be re-read.
+void MarsImpl::drop_frames(bool forget) {
+    for (auto & f : pool) {
+        if (f.dirty)
+            IOcall(f.addr, f.w);
+        f.dirty = false;
+        if (forget)
+            f.addr = NOZONE;
+    }
+    dirty &= ~2;
+}
+
+// Empties the buffer pool and resizes it as configured
+void MarsImpl::reset_pool() {
+    pool.assign(std::max(1u, mars.buffers), Frame{NOZONE, false, false, absent.w, nullptr});
+    curFrame = nullptr;
+    hand = 0;
+    dirty &= ~2;
+}
+
 // Takes the zone number as the argument,
 // returns the pointer to the zone read in curbuf
 void MarsImpl::get_zone(uint64_t arg) {
     curZone = arg;
     uint64_t zoneKey = arg | DBkey;
-    curbuf = (arg & 01777) ? bdbuf : bdtab;
-    if (curbuf[0] == zoneKey)
-        return;
-    if (curZone && is_dirty_buf()) {
-        dirty &= ~2;
-        IOcall(IOpat + (curbuf[0] & 01777), bdbuf);
+    if (arg & 01777) {
+        // A data zone, likely in the buffer pool already
+        if (!curFrame || curFrame->addr != IOpat + arg)
+            curFrame = &get_frame(IOpat + arg);
+        curbuf = bdbuf = curFrame->w;
+        curSlots = curFrame->slots;
+    } else {
+        curbuf = bdtab;
+        curSlots = slot_index(IOpat).data();
+        if (curbuf[0] != zoneKey)
+            IOcall((curZone | ONEBIT(40)) + IOpat, curbuf);
     }
-    IOcall((curZone | ONEBIT(40)) + IOpat, curbuf);
     if (curbuf[0] == zoneKey)
         return;
     std::cerr << std::format("Corruption: zoneKey = {:o}, data = {:o}\n", zoneKey, curbuf[0]);
@@ -384,7 +999,7 @@ void MarsImpl::save(bool force_tab = false) {
         IOcall(IOpat, bdtab);
     }
     if (is_dirty_buf()) {
-        IOcall(IOpat + (bdbuf[0] & 01777), bdbuf);
+        drop_frames(false);
     }
     dirty = 0;
 }
@@ -392,6 +1007,8 @@ void MarsImpl::save(bool force_tab = false) {
 void MarsImpl::finalize(const char * msg) {
     bool force_tab = false;
     mars.errmsg = msg;
+    if (transaction)
+        return;                 // saved by commit()
     if (disableSync != 0) {
         if (disableSync != 1)
             return;
@@ -401,6 +1018,8 @@ void MarsImpl::finalize(const char * msg) {
         }
     }
     save(force_tab);
+    if (logfd >= 0)
+        write_log();
 }
 
 // Returns the constructed extent header
@@ -436,13 +1055,131 @@ uint64_t* MarsImpl::make_metablock(uint64_t key) {
 }
 
 // Usable space is one word (extent handle) less than free space
+static uint64_t usable(uint64_t free) {
+    return free ? free - 1 : 0;
+}
+
+// The total is kept along with the segment tree;
+// with check_space, it is checked against the sum
 uint64_t MarsImpl::usable_space() {
-    uint64_t l = 0;
-    for (int i = dblen - 1; i >= 0; --i) {
-        if (freeSpace[i] != 0)
-            l += freeSpace[i] - 1;
+    index_free();
+    if (mars.check_space) {
+        uint64_t l = 0;
+        for (int i = dblen - 1; i >= 0; --i)
+            l += usable(freeSpace[i]);
+        if (l != freeUsable) {
+            std::cerr << std::format("Usable space {:o}, kept as {:o}\n", l, freeUsable);
+            throw Mars::ERR_INTERNAL;
+        }
+    }
+    return freeUsable;
+}
+
+// Builds the segment tree over the free space array if it is stale
+void MarsImpl::index_free() {
+    if (freeIndexed == &freeSpace[0] && freeTree.size() == 2*freeLeaves &&
+        freeLeaves >= dblen && freeLeaves < 2*dblen)
+        return;
+    freeIndexed = &freeSpace[0];
+    freeLeaves = std::bit_ceil(std::max<size_t>(dblen, 1));
+    freeTree.assign(2*freeLeaves, 0);
+    freeUsable = 0;
+    for (size_t i = 0; i < dblen; ++i) {
+        freeTree[freeLeaves + i] = freeSpace[i];
+        freeUsable += usable(freeSpace[i]);
     }
-    return l;
+    for (size_t i = freeLeaves - 1; i > 0; --i)
+        freeTree[i] = std::max(freeTree[2*i], freeTree[2*i+1]);
+}
+
+// All changes of the free space array go through here
+void MarsImpl::set_free(unsigned zone, uint64_t words) {
+    if (freeIndexed == &freeSpace[0] && zone < dblen)
+        freeUsable += usable(words) - usable(freeSpace[zone]);
+    freeSpace[zone] = words;
+    if (freeIndexed != &freeSpace[0] || zone >= freeLeaves)
+        return;
+    size_t i = freeLeaves + zone;
+    freeTree[i] = words;
+    for (i /= 2; i > 0; i /= 2)
+        freeTree[i] = std::max(freeTree[2*i], freeTree[2*i+1]);
+}
+
+// Returns the first zone from 'from' on with more free words than 'more', or -1
+int MarsImpl::first_free(uint64_t more, size_t from) {
+    index_free();
+    size_t i = 1;
+    if (from >= dblen) {
+        return -1;
+    } else if (from) {
+        // Climbing from the boundary until there is enough to the right of it
+        for (i = freeLeaves + from - 1; !(!(i & 1) && freeTree[i+1] > more); i /= 2) {
+            if (i == 1)
+                return -1;
+        }
+        ++i;
+    } else if (freeTree[1] <= more) {
+        return -1;
+    }
+    // Descending to the leftmost leaf with enough
+    while (i < freeLeaves)
+        i = freeTree[2*i] > more ? 2*i : 2*i+1;
+    return i - freeLeaves;
+}
+
+// Returns a zone with more free words than 'more' according to
+// the allocation policy, or -1
+int MarsImpl::fit_zone(uint64_t more) {
+    switch (mars.alloc_policy) {
+    case Mars::FIRST_FIT:
+        break;
+    case Mars::BEST_FIT: {
+        // The tree only has the maxima, a scan it is
+        int best = -1;
+        for (size_t i = 0; i < dblen; ++i) {
+            if (more < freeSpace[i] && (best < 0 || freeSpace[i] < freeSpace[best]))
+                best = i;
+        }
+        return best;
+    }
+    case Mars::NEAR_FIT: {
+        // The zone of the last metadata block read, the leaf for the data;
+        // if it is the root, or none since the root has been set up,
+        // there is no leaf but the root to be near, in the catalog zone
+        if (!blockHandle.full || blockHandle.full == ROOT_METABLOCK)
+            break;
+        int zone = Handle(blockHandle).zone;
+        if (zone >= int(dblen))
+            break;
+        if (more < freeSpace[zone])
+            return zone;
+        int below = last_free(more, zone), above = first_free(more, zone + 1);
+        if (below < 0 || (above >= 0 && above - zone < zone - below))
+            return above;
+        return below;
+    }
+    }
+    return first_free(more);
+}
+
+// Returns the last zone below 'below' with more free words than 'more', or -1
+int MarsImpl::last_free(uint64_t more, size_t below) {
+    index_free();
+    size_t i = 1;
+    if (below < freeLeaves) {
+        // Climbing from the boundary until there is enough to the left of it
+        for (i = freeLeaves + below; !(i & 1 && freeTree[i-1] > more); i /= 2) {
+            if (i == 1)
+                return -1;
+        }
+        --i;
+    } else if (freeTree[1] <= more) {
+        return -1;
+    }
+    // Descending to the rightmost leaf with enough
+    while (i < freeLeaves)
+        i = freeTree[2*i+1] > more ? 2*i+1 : 2*i;
+    return i - freeLeaves;
 }
 
 // Finds item indicated by the zone number in bits 10-1
@@ -461,9 +1198,13 @@ uint64_t MarsImpl::find_item(uint64_t arg) {
     // need to search only from the indicated position toward lower addresses.
     if (record >= h.ext)
         record = h.ext;
-    handlePtr = record;
-    for (;;) {
+    handlePtr = curSlots[id];
+    if (handlePtr && handlePtr <= record &&
+        Extent(curbuf[handlePtr + 1]).id == id) {
+        curExtent = curbuf[handlePtr + 1];
+    } else for (handlePtr = record;;) {
         curExtent = curbuf[handlePtr + 1];
+        curSlots[curExtent.id] = handlePtr;
         if (curExtent.id == id) {
             break;
         }
@@ -507,20 +1248,23 @@ std::string inPage(uint64_t *ptr, uint64_t* page, const char * name) {
 }
 
 void MarsImpl::copy_words(uint64_t *dst, uint64_t* src, int len) {
-    std::string srcStr, dstStr;
-    srcStr = inPage(src, bufpage, "buf");
-    if (srcStr.empty())
+    if (verbose) {
+        std::string srcStr, dstStr;
         srcStr = inPage(src, tabpage, "tab");
-    if (srcStr.empty())
-        srcStr = "user memory";
-    dstStr = inPage(dst, bufpage, "buf");
-    if (dstStr.empty())
         dstStr = inPage(dst, tabpage, "tab");
-    if (dstStr.empty())
-        dstStr = "user memory";
-    if (verbose)
+        for (auto & f : pool) {
+            if (srcStr.empty())
+                srcStr = inPage(src, f.w, "buf");
+            if (dstStr.empty())
+                dstStr = inPage(dst, f.w, "buf");
+        }
+        if (srcStr.empty())
+            srcStr = "user memory";
+        if (dstStr.empty())
+            dstStr = "user memory";
         std::cerr << std::format("{:o}(8) words from {} to {}\n", len,
                                  srcStr, dstStr);
+    }
     // Using backwards store order to match the original binary for ease of debugging.
     while (len) {
         dst[len-1] = src[len-1];
@@ -531,6 +1275,7 @@ void MarsImpl::copy_words(uint64_t *dst, uint64_t* src, int len) {
 // Copies chained extents to user memory (len = length of the first extent)
 void MarsImpl::copy_chained(int len, uint64_t* &usrloc) { // a01423
     for (;;) {
+        prefetch(curExtent.next);
         if (len) {
             if (verbose)
                 std::cerr << "From DB: ";
@@ -560,7 +1305,10 @@ void MarsImpl::lock() {
     bdtab[1] = bdtab[1] ^ LOCKKEY;
     if (!(bdtab[1] & LOCKKEY))
         throw Mars::ERR_LOCKED;
-    bdbuf[0] = LOCKKEY;         // What is the purpose of this?
+    // Originally bdbuf[0] = LOCKKEY, to have the data zones re-read
+    // as they might have been changed by another user of the DB
+    drop_frames(true);
+    filters.clear();
     IOcall(IOpat, bdtab);
 }
 
@@ -579,6 +1327,24 @@ void MarsImpl::get_block(uint64_t descr, uint64_t* dest) {
     }
 }
 
+// Sets the size of the secondary metablocks of the current DB
+void MarsImpl::set_fanout(unsigned keys) {
+    fanout = keys;
+    if (fanout == 16) {
+        Secondary = mars.bdv.SecBlk+1;
+    } else {
+        wideBlock.resize(4*fanout + 2);
+        Secondary = wideBlock.data()+1;
+    }
+}
+
+// Lets the backend read in the zone of the item in advance
+void MarsImpl::prefetch(uint64_t arg) {
+    Handle h(arg);
+    if (mars.prefetch && h.zone)
+        mars.backend->prefetch((IOpat + h.zone) & BITS(18));
+}
+
 // Requests the root block into the main RootBlock array
 void MarsImpl::get_root_block() {
     get_block(ROOT_METABLOCK, &RootBlock->header.word);
@@ -603,6 +1369,11 @@ uint64_t MarsImpl::skip(Error e) {
 }
 
 void MarsImpl::setctl(uint64_t location) {
+    if (transaction && is_dirty_tab()) {
+        // The catalog of the previous DB will not be saved by commit()
+        IOcall(IOpat, bdtab);
+        dirty &= ~1;
+    }
     IOpat = location & 0777777;
     dblen = dbdesc >> 18;
     IOcall(IOpat | ONEBIT(40), bdtab);
@@ -613,6 +1384,8 @@ void MarsImpl::setctl(uint64_t location) {
     blockHandle = 0;
     curZone = 0;
     freeSpace = bdtab + (bdtab[3] & 01777) + 2;
+    // The format is recorded in the header of the free space array
+    set_fanout(ExtentHeader(freeSpace[-1]).unknown == WIDE_FANOUT ? WIDE_FANOUT : 16);
     get_root_block();
 }
 
@@ -635,14 +1408,12 @@ void MarsImpl::free_extent(int pos) {
         auto freeLoc = curbuf + freeIdx;
         auto loc = freeLoc + extLength;
         // Move the extent data up to make the free area
-        // contiguous
-        do {
-            loc[diff] = freeLoc[diff];
-        } while(--diff);
+        // contiguous (the word at freeIdx itself is free)
+        std::memmove(loc + 1, freeLoc + 1, diff * sizeof(uint64_t));
     }
     // Correct the free area location and the number of extents at once
     curbuf[1] = curbuf[1] - 02000 + extLength;
-    freeSpace[curZone] = freeSpace[curZone] + extLength + 1;
+    set_free(curZone, freeSpace[curZone] + extLength + 1);
     set_dirty_data();
 }
 
@@ -651,9 +1422,11 @@ void MarsImpl::free(uint64_t arg) {
         find_item(arg);
         int extCount = (curbuf[1] >> 10) & 077777;
         // position of the extent to be freed
+        curSlots[curExtent.id] = 0;
         for (int i = handlePtr; i != extCount; ++i) {
             // shrink the extent handle array
             curbuf[i+1] = curbuf[i+2];
+            curSlots[Extent(curbuf[i+1]).id] = i;
         };
         free_extent(extCount);
         arg = curExtent.next;
@@ -733,6 +1506,7 @@ bool MarsImpl::step(uint64_t dir) {
     if (!cur.steps && !cur.pos)
         throw Mars::ERR_NO_CURR;
     int pos = cur.pos;
+    bool entered = false;
     if (!dir) {
         // Step forward
         pos++;
@@ -745,6 +1519,7 @@ bool MarsImpl::step(uint64_t dir) {
             get_secondary_block(next);
             ++Cursor[idx-1].steps;
             pos = 0;
+            entered = true;
         }
     } else {
         // Step back
@@ -757,9 +1532,14 @@ bool MarsImpl::step(uint64_t dir) {
             get_secondary_block(prev);
             --Cursor[idx-1].steps;
             pos = block_len(Secondary[0]) / 2;
+            entered = true;
         }
         pos--;
     }
+    // The keys left to step over in this block before the next one
+    unsigned left = dir ? pos : curMetaBlock->header.len/2 - 1 - pos;
+    if (left == mars.prefetch_distance || (entered && left < mars.prefetch_distance))
+        prefetch(dir ? curMetaBlock->header.prev : curMetaBlock->header.next);
     cur.pos = pos;
     cur.steps = ONEBIT(16);
     curkey = curMetaBlock->element[pos].key;
@@ -789,6 +1569,7 @@ bool MarsImpl::access_data(Ops op, uint64_t arg) {
             auto next = curExtent.next;
             if (next) {
                 find_item(next);
+                prefetch(curExtent.next);
                 continue;
             }
             if (op == DONE
@@ -878,10 +1659,12 @@ uint64_t MarsImpl::handle_chunk(int zone, uint64_t head) {
         if (id == ext.id)
             break;
         curbuf[id+2] = curbuf[id+1];
+        curSlots[ext.id] = id+1;
         --id;
     } while (id);
     ++id;
     handlePtr = id;
+    curSlots[id] = id;
     return (id << 39) | head;
 }
 
@@ -896,7 +1679,7 @@ uint64_t MarsImpl::allocator1023(uint64_t firstWord, uint64_t *usrloc) {
     auto free = freeSpace[curZone];
     int zone, remlen = 0;
     ++mylen;
-    if (mylen < free) {
+    if (mylen < free && mars.alloc_policy == Mars::FIRST_FIT) {
         // The datum fits in the current zone!
         zone = curZone;
     } else {
@@ -905,15 +1688,13 @@ uint64_t MarsImpl::allocator1023(uint64_t firstWord, uint64_t *usrloc) {
         // If the datum is larger than MAXCHUNK, it will have to be split
         if (mylen < Mars::MAXCHUNK) {
             // Find a zone with enough free space
-            for (size_t i = 0; i < dblen; ++i) {
-                if (mylen < freeSpace[i]) {
-                    return allocator1047(0, handle_chunk(i, 0), firstWord, 0, usrloc);
-                }
+            if (int i = fit_zone(mylen); i >= 0) {
+                return allocator1047(0, handle_chunk(i, 0), firstWord, 0, usrloc);
             }
         }
         // End reached, or the length is too large: must split
         usrloc += mylen - 1;
-        for (i = dblen; freeSpace[i-1] < 2 && --i;);
+        i = last_free(1, dblen) + 1;
         if (i == 0)
             overflow(0);
         zone = i - 1;
@@ -945,7 +1726,7 @@ uint64_t MarsImpl::allocator1047(int loc, uint64_t head, uint64_t firstWord, int
         if (verbose)
           std::cerr << std::format("Reducing free {:o} by len {:o} + 1\n",
                                    freeSpace[curZone], mylen);
-        freeSpace[curZone] -= mylen+1;
+        set_free(curZone, freeSpace[curZone] - (mylen+1));
         if (verbose)
           std::cerr << std::format("Got {:o}\n", freeSpace[curZone]);
         if (!loc) {
@@ -957,11 +1738,9 @@ uint64_t MarsImpl::allocator1047(int loc, uint64_t head, uint64_t firstWord, int
         head = newDescr << 20;
         mylen = remlen;
         if (--loc) {
-            while (freeSpace[loc-1] < 2) {
-                if (--loc)
-                    continue;
+            loc = last_free(1, loc) + 1;
+            if (!loc)
                 overflow(head);
-            }
             int zone = loc - 1;
             loc = prepare_chunk(loc, remlen, usrloc);
             head = handle_chunk(zone, head);
@@ -978,6 +1757,10 @@ void MarsImpl::mkctl() {
     IOpat = dbdesc & 0777777;
     curbuf = bdtab;
     uint64_t writeWord = IOpat;
+    // The zones are overwritten, any copies in the pool are stale
+    drop_frames(true);
+    // The free space array is built in the scratch page
+    bdbuf = bufpage;
     bdtab[1] = 01777;           // last free location in zone
     do {
         --nz;
@@ -986,6 +1769,7 @@ void MarsImpl::mkctl() {
         IOcall(writeWord + nz, bdtab);
     } while (nz);
     freeSpace = bdbuf;     // freeSpace[0] is now the same as bdbuf[0]
+    freeIndexed = nullptr;
     myloc = bdbuf;
     Cursor[0].block_id = ROOT_METABLOCK;
     allocator(make_metablock(0));
@@ -993,7 +1777,14 @@ void MarsImpl::mkctl() {
     // This trick results in max possible DB length = 753 zones.
     // bdbuf[0] = 01731 - mylen;
     // Invoking OP_ALLOC for the freeSpace array
-    allocHandle = allocator(myloc);
+    set_fanout(mars.wide_blocks ? WIDE_FANOUT : 16);
+    auto header = make_extent_header();
+    if (mars.wide_blocks)
+        header.unknown = WIDE_FANOUT;
+    allocHandle = allocator1023(header, myloc);
+    filters.erase(IOpat);
+    if (mars.bloom_bits)
+        filters.emplace(IOpat, Bloom(0, mars.bloom_bits));
     bdtab[01736-dblen] = 01731 - dblen; // This is the right way
 }
 
@@ -1030,12 +1821,31 @@ void MarsImpl::find_end_word() {
 
 void MarsImpl::search_in_block(Metablock *block, uint64_t what) {
     bool indirect = block->element[0].indirect;
-    int i = block->header.len / 2;
+    const int n = block->header.len / 2;
     if (verbose)
-        std::cerr << std::format("Comparing {} elements\n", i);
-    for (; i; i--) {
-        if (block->element[i-1].key <= what)
-            break;
+        std::cerr << std::format("Comparing {} elements\n", n);
+    // Find the number of keys not above 'what'; the keys are sorted
+    int i = 0;
+    switch (mars.key_search) {
+    case Mars::LINEAR_SEARCH:
+        for (i = n; i; i--) {
+            if (block->element[i-1].key <= what)
+                break;
+        }
+        break;
+    case Mars::BINARY_SEARCH:
+        for (int hi = n; i < hi; ) {
+            int mid = (i + hi) / 2;
+            if (block->element[mid].key <= what)
+                i = mid + 1;
+            else
+                hi = mid;
+        }
+        break;
+    case Mars::COUNTING_SEARCH:
+        for (int j = 0; j < n; ++j)
+            i += block->element[j].key <= what;
+        break;
     }
     i--;
     Cursor[idx].pos = i;
@@ -1054,6 +1864,26 @@ void MarsImpl::search_in_block(Metablock *block, uint64_t what) {
 }
 
 void MarsImpl::find(uint64_t k) {
+    if (mars.append && appendGeneration + 1 == generation && appendDB == IOpat &&
+        idx == appendLevel && Cursor[idx].block_id == appendLeaf) {
+        // The cursor is still at the leaf of the insert by the previous
+        // operation, unless another DB or directory has been set since;
+        // the key belongs there if it is not outside of the keys of the leaf
+        auto & leaf = *curMetaBlock;
+        int n = leaf.header.len/2;
+        if (n && leaf.element[0].key <= k &&
+            (!leaf.header.next || k <= leaf.element[n-1].key)) {
+            if (idx > 1) {
+                // The descent would read the leaf again, leaving the zone
+                // of its last extent current for the allocation
+                find_item(Cursor[idx].block_id);
+                while (curExtent.next)
+                    find_item(curExtent.next);
+            }
+            search_in_block(curMetaBlock, k);
+            return;
+        }
+    }
     idx = 0;
     if (!Cursor[0].block_id) {
         // There was an overflow, re-reading is needed
@@ -1107,6 +1937,7 @@ void MarsImpl::update(uint64_t arg, uint64_t* usrloc) {
 }
 
 Error MarsImpl::eval() try {
+    ++generation;
     if (bdtab[0] != DBkey && IOpat) {
         IOcall(ONEBIT(40) | IOpat, bdtab);
     }
@@ -1214,11 +2045,24 @@ uint64_t MarsImpl::one_insn() {
     case Mars::OP_OPEN:
         setctl(dbdesc);
         break;
-    case Mars::OP_ADDKEY:
+    case Mars::OP_ADDKEY: {
         workHandle = allocHandle;
         add_key(key, workHandle, false);
-        return update_btree();
+        add_to_filter(key);
+        auto leaf = idx;
+        auto next = update_btree();
+        // Unless a block has been split or the root has moved down
+        if (idx == leaf && !curMetaBlock->element[0].indirect) {
+            appendGeneration = generation;
+            appendDB = IOpat;
+            appendLevel = leaf;
+            appendLeaf = Cursor[leaf].block_id;
+        }
+        return next;
+    }
     case Mars::OP_DELKEY:
+        if (auto f = filters.find(IOpat); f != filters.end())
+            ++f->second.deleted;
         return update_btree(del_key());
     case Mars::OP_LOOP:
         return orgcmd;
@@ -1390,8 +2234,15 @@ auto MarsImpl::del_key() -> BtreeArgs {
             curMetaBlock->element[i] = curMetaBlock->element[i+1];
         }
         curMetaBlock->header.len -= 2; // This should be before setting up len
-        if (curMetaBlock->header.len != 0)
+        if (curMetaBlock->header.len != 0) {
+            if (!mars.merge_below)
+                break;
+            // After a merge, the parent element of the block gone is deleted
+            if (idx && curMetaBlock->header.len/2 < mars.merge_below && merge_block(first))
+                continue;
+            collapse_root();
             break;
+        }
         // The current metablock became empty
         if (!idx)               // That was the root metablock?
             return bta;         // Do not free it
@@ -1414,6 +2265,95 @@ auto MarsImpl::del_key() -> BtreeArgs {
     return bta;
 }
 
+// Merges the current secondary block, left underfull by a deletion,
+// with its right or left neighbour under the same parent, if they fit
+// in one block; the merged block keeps the handle of the left one.
+// On success, leaves the cursor at the parent element to be deleted.
+bool MarsImpl::merge_block(bool first) {
+    CursorElt & up = Cursor[idx-1];
+    // The parent position is not known after stepping over the blocks
+    if (up.steps != ONEBIT(16))
+        return false;
+    unsigned parentLen = idx == 1 ? RootBlock->header.len
+        : get_block_header(up.block_id).len;
+    // If the first key is gone, the block cannot keep its parent element
+    bool right = !first && up.pos + 1u < parentLen/2;
+    if (!right && !up.pos)
+        return false;
+    uint64_t sibling = right ? next_block(Secondary[0]) : prev_block(Secondary[0]);
+    std::vector<uint64_t> buf(4*fanout + 2);
+    auto ptr = buf.data();
+    copy_chained(find_item(sibling), ptr);
+    auto other = reinterpret_cast<Metablock*>(buf.data() + 1);
+    unsigned len = curMetaBlock->header.len, total = len + other->header.len;
+    // Leaving room for the next inserts before a split
+    if (total > 3*fanout)
+        return false;
+    uint64_t keep, gone, chain = Secondary[0];
+    unsigned gonePos;
+    if (right) {
+        std::copy_n(other->element, other->header.len/2, curMetaBlock->element + len/2);
+        Secondary[0] = Metablock::Header(prev_block(chain), other->header.next, total);
+        keep = blockHandle.full;
+        gone = sibling;
+        gonePos = up.pos + 1;
+        chain = other->header;
+    } else {
+        std::copy_backward(curMetaBlock->element, curMetaBlock->element + len/2,
+                           curMetaBlock->element + total/2);
+        std::copy_n(other->element, other->header.len/2, curMetaBlock->element);
+        Secondary[0] = Metablock::Header(other->header.prev, next_block(chain), total);
+        keep = sibling;
+        gone = blockHandle.full;
+        gonePos = up.pos;
+        Cursor[idx].pos += other->header.len/2;
+    }
+    if (verbose)
+        std::cerr << std::format("Merging block {:o} into {:o}\n", gone, keep);
+    free(gone);
+    blockHandle = keep;
+    Cursor[idx].block_id = keep;
+    mylen = total + 1;
+    update(keep, Secondary);
+    update_prev(chain, keep);
+    propagate_steps();
+    Cursor[idx].pos = gonePos;
+    return true;
+}
+
+// Replaces a root block pointing to a single secondary block
+// with the contents of that block while they fit with room to spare.
+void MarsImpl::collapse_root() {
+    if (idx == 1 && RootBlock->header.len == 2) {
+        // The current block is the only one below the root
+        if (curMetaBlock->header.len > (META_SIZE-1)/2)
+            return;
+        std::copy_n(Secondary, curMetaBlock->header.len + 1, &RootBlock->header.word);
+        free(blockHandle);
+        blockHandle = 0;
+        idx = 0;
+        curMetaBlock = RootBlock;
+    }
+    if (idx)
+        return;
+    std::vector<uint64_t> buf(4*fanout + 2);
+    while (RootBlock->header.len == 2 && RootBlock->element[0].indirect) {
+        uint64_t child = RootBlock->element[0].id;
+        auto ptr = buf.data();
+        copy_chained(find_item(child), ptr);
+        auto block = reinterpret_cast<Metablock*>(buf.data() + 1);
+        if (block->header.len > (META_SIZE-1)/2)
+            return;
+        if (verbose)
+            std::cerr << std::format("Moving block {:o} up to the root\n", child);
+        // The only block of its level has no neighbours
+        std::copy_n(buf.data() + 1, block->header.len + 1, &RootBlock->header.word);
+        free(child);
+        // The handle may be given to another block
+        blockHandle = 0;
+    }
+}
+
 // Updates the BTree after insertion or deletion.
 uint64_t MarsImpl::update_btree(BtreeArgs bta) {
     uint64_t &key = bta.key;
@@ -1436,7 +2376,7 @@ uint64_t MarsImpl::update_btree(BtreeArgs bta) {
         set_dirty_tab();        // likely unnecessary, update() sets the flags
         return curcmd >> 6;
     }
-    if (curMetaBlock->header.len != 0100) {
+    if (curMetaBlock->header.len != 4*fanout) {
         // The current metablock has not reached the max allowed length
         mylen = curMetaBlock->header.len + 1;
         update(blockHandle, (uint64_t*)curMetaBlock);
@@ -1448,21 +2388,22 @@ uint64_t MarsImpl::update_btree(BtreeArgs bta) {
         }
         return curcmd >> 6;
     }
-    need = (idx * 4) + META_SIZE;
+    need = (idx * 4) + 2*fanout+1;
     if (RootBlock->header.len == 036) {
         // The root metadata block is full, account for potentially adding a level
         need = need + 044;
     }
     check_space(need);
     // Split the block in two
-    auto old = Secondary[040];
-    Secondary[040] = Metablock::Header(blockHandle, next_block(Secondary[0]), 040);
-    mylen = META_SIZE;
-    uint64_t newDescr = allocator((uint64_t*)curMetaBlock + 040);
-    Secondary[040] = old;
-    key = Secondary[META_SIZE];
+    const unsigned half = 2*fanout;
+    auto old = Secondary[half];
+    Secondary[half] = Metablock::Header(blockHandle, next_block(Secondary[0]), half);
+    mylen = half+1;
+    uint64_t newDescr = allocator((uint64_t*)curMetaBlock + half);
+    Secondary[half] = old;
+    key = Secondary[half+1];
     auto origHeader = Secondary[0];
-    Secondary[0] = Metablock::Header(prev_block(origHeader), newDescr, 040);
+    Secondary[0] = Metablock::Header(prev_block(origHeader), newDescr, half);
     uint64_t link = newDescr;
     mylen = block_len(Secondary[0]) + 1;
     update(blockHandle, Secondary);
@@ -1473,13 +2414,355 @@ uint64_t MarsImpl::update_btree(BtreeArgs bta) {
 }
 
 void MarsImpl::setup() {
+    if (transaction)
+        save();
     for (size_t i = 0; i < 1024; ++i) {
         bufpage[i] = tabpage[i] = 0;
     }
     // Faking MARS words
     bdtab = tabpage;
     bdbuf = bufpage;
+    reset_pool();
+    filters.clear();
     abdv = mars.bdv.w;
+    if (!mars.backend) {
+        switch (mars.storage) {
+        case Mars::ZONE_FILES:
+            mars.backend = std::make_unique<ZoneFileBackend>(verbose);
+            break;
+        case Mars::LUN_FILES:
+            mars.backend = std::make_unique<LunFileBackend>(mars.flush);
+            break;
+        case Mars::MEMORY:
+            mars.backend = std::make_unique<MemoryBackend>();
+            break;
+        }
+    }
+    open_log();
+}
+
+Error MarsImpl::begin() {
+    if (!transaction) {
+        save();
+        if (logfd >= 0)
+            write_log();
+        transaction = true;
+        // Every data zone is to be preserved on its first access
+        curFrame = nullptr;
+    }
+    mars.errmsg = nullptr;
+    return mars.status = Mars::ERR_SUCCESS;
+}
+
+Error MarsImpl::commit() {
+    transaction = false;
+    finalize(nullptr);
+    if (logfd < 0) {
+        forget_preserved();
+        if (mars.flush)
+            IOflush();
+    }
+    return mars.status = Mars::ERR_SUCCESS;
+}
+
+// Restores the zones changed in the transaction, discarding
+// the data frames, and re-reads the catalog and the root block.
+Error MarsImpl::rollback() try {
+    ++generation;
+    transaction = false;
+    for (auto & [addr, copy] : Undo) {
+        preserved[addr] = false;
+        if (copy) {
+            std::copy(copy->w, copy->w+1024, mars.backend->write(addr));
+        } else {
+            // The zone did not exist, nothing to write out
+            mars.backend->remove(addr);
+            isDirty[addr] = false;
+        }
+    }
+    Undo.clear();
+    std::erase_if(DirtyZones, [this](uint64_t addr) { return !isDirty[addr]; });
+    for (auto & f : pool) {
+        f.addr = NOZONE;
+        f.dirty = false;
+    }
+    curFrame = nullptr;
+    filters.clear();
+    dirty = 0;
+    mars.errmsg = nullptr;
+    if (dbdesc) {
+        IOcall(IOpat | ONEBIT(40), bdtab);
+        freeSpace = bdtab + (bdtab[3] & 01777) + 2;
+        idx = 0;
+        blockHandle = 0;
+        get_block(Cursor[0].block_id ? Cursor[0].block_id : ROOT_METABLOCK,
+                  &RootBlock->header.word);
+    }
+    return mars.status = Mars::ERR_SUCCESS;
+} catch (Error e) {
+    std::cerr << std::format("ERROR {} ({})\n", int(e), msg[e-1]);
+    mars.errmsg = msg[e-1];
+    return mars.status = e;
+}
+
+Error MarsImpl::bulk_load(std::span<const Mars::Record> records) {
+    bool own = !transaction;
+    if (own)
+        begin();
+    try {
+        load_records(records);
+    } catch (Error e) {
+        std::cerr << std::format("ERROR {} ({})\n", int(e), msg[e-1]);
+        if (own)
+            rollback();
+        mars.errmsg = msg[e-1];
+        return mars.status = e;
+    }
+    return own ? commit() : mars.status = Mars::ERR_SUCCESS;
+}
+
+void MarsImpl::load_records(std::span<const Mars::Record> records) {
+    ++generation;
+    if (bdtab[0] != DBkey && IOpat) {
+        IOcall(ONEBIT(40) | IOpat, bdtab);
+    }
+    // Only the sentinel with key 0 may be there, as in a new DB
+    if (RootBlock->header.len != 2 || RootBlock->element[0].indirect)
+        throw Mars::ERR_EXISTS;
+    uint64_t last = 0;
+    for (auto & r : records) {
+        if (r.key <= last || r.key & ONEBIT(48))
+            throw Mars::ERR_INV_NAME;
+        last = r.key;
+    }
+    // A secondary block splits as it reaches 2*fanout keys, it is
+    // filled to 3/4 of that for the inserts not to split it at once;
+    // the root moves down as it reaches 16 keys
+    const size_t perBlock = 3*fanout/2, perRoot = 15;
+    size_t count = records.size() + 1;
+    for (int depth = 0; count > perRoot; ++depth) {
+        if (depth == 3)
+            throw Mars::ERR_OVERFLOW;
+        count = (count + perBlock - 1) / perBlock;
+    }
+
+    // The elements of the level being built, as the pairs of words
+    std::vector<std::pair<uint64_t, uint64_t>> level, upper;
+    level.reserve(records.size() + 1);
+    level.emplace_back(0, RootBlock->element[0].handle);
+    for (auto & r : records) {
+        mylen = r.len;
+        // The allocator only reads the data
+        level.emplace_back(r.key, allocator(const_cast<uint64_t*>(r.loc)));
+        add_to_filter(r.key);
+    }
+    std::vector<uint64_t> block;
+    while (level.size() > perRoot) {
+        upper.clear();
+        // Spreading the keys evenly, for the last block not to be small
+        size_t blocks = (level.size() + perBlock - 1) / perBlock;
+        uint64_t prev = 0;
+        for (size_t i = 0, b = 0; b < blocks; ++b) {
+            size_t n = (level.size() - i) / (blocks - b);
+            block.assign(1, Metablock::Header(prev, 0, 2*n));
+            for (size_t j = i; j < i + n; ++j) {
+                block.push_back(level[j].first);
+                block.push_back(level[j].second);
+            }
+            mylen = block.size();
+            uint64_t handle = allocator(block.data());
+            if (prev) {
+                auto head = get_block_header(prev);
+                head.next = handle;
+                set_header(head);
+            }
+            upper.emplace_back(level[i].first, handle | ONEBIT(48));
+            prev = handle;
+            i += n;
+        }
+        level.swap(upper);
+    }
+    RootBlock->header = Metablock::Header(0, 0, 2*level.size());
+    for (size_t i = 0; i < level.size(); ++i) {
+        RootBlock->element[i].key = level[i].first;
+        RootBlock->element[i].handle = level[i].second;
+    }
+    mylen = META_SIZE;
+    update(ROOT_METABLOCK, &RootBlock->header.word);
+    idx = 0;
+    Cursor[0] = CursorElt{ROOT_METABLOCK, 0, 0};
+    curMetaBlock = RootBlock;
+    blockHandle = 0;
+}
+
+// Goes through the records from defragKey for about 'slice',
+// moving the chained data into single extents
+bool MarsImpl::defrag(std::chrono::microseconds slice) try {
+    auto deadline = std::chrono::steady_clock::now() + slice;
+    ++generation;
+    if (bdtab[0] != DBkey && IOpat) {
+        IOcall(ONEBIT(40) | IOpat, bdtab);
+    }
+    if (defragDB != IOpat) {
+        defragDB = IOpat;
+        defragKey = 0;
+    }
+    // For step() to throw at the end
+    curcmd = 0;
+    find(defragKey);
+    if (curkey < defragKey)
+        step(0);
+    for (;;) {
+        // The key 0 of the first leaf is not a record
+        if (curkey && relocate())
+            // The leaf element points to the new place
+            update_btree();
+        if (std::chrono::steady_clock::now() >= deadline)
+            break;
+        step(0);
+    }
+    defragKey = curkey + 1;
+    finalize(nullptr);
+    mars.status = Mars::ERR_SUCCESS;
+    return false;
+} catch (Error e) {
+    defragKey = 0;
+    if (e == Mars::ERR_NO_NEXT) {
+        finalize(nullptr);
+        mars.status = Mars::ERR_SUCCESS;
+        return true;
+    }
+    std::cerr << std::format("ERROR {} ({})\n", int(e), msg[e-1]);
+    mars.errmsg = msg[e-1];
+    mars.status = e;
+    // Not to be called again and again by a loop waiting for the end
+    return true;
+}
+
+// Moves the datum of the current leaf element to a single extent
+// if it is chained and a zone has room for all of it
+bool MarsImpl::relocate() {
+    auto handle = workHandle;
+    info(handle);
+    if (!curExtent.next || datumLen + 1 >= Mars::MAXCHUNK || first_free(datumLen + 1) < 0)
+        return false;
+    std::vector<uint64_t> data(datumLen);
+    auto header = curWord;
+    auto usrloc = data.data();
+    ++extPtr;
+    --extLength;
+    copy_chained(extLength, usrloc);
+    // The new place is taken first, for the data not to be lost
+    // if there is no room after all
+    mylen = datumLen;
+    workHandle = allocator1023(header, data.data());
+    free(handle);
+    curMetaBlock->element[Cursor[idx].pos].id = workHandle;
+    return true;
+}
+
+// Builds the Bloom filter of the current DB from all its keys
+void MarsImpl::build_filter() {
+    ++generation;
+    std::vector<uint64_t> keys;
+    auto cmd = curcmd;
+    // For step() to throw at the end
+    curcmd = 0;
+    try {
+        find(0);
+        for (;;) {
+            step(0);
+            keys.push_back(curkey);
+        }
+    } catch (Error e) {
+        curcmd = cmd;
+        if (e != Mars::ERR_NO_NEXT)
+            throw;
+    }
+    auto & f = filters.insert_or_assign(IOpat, Bloom(keys.size(), mars.bloom_bits)).first->second;
+    for (auto k : keys)
+        f.add(k);
+}
+
+void MarsImpl::add_to_filter(uint64_t k) {
+    if (auto f = filters.find(IOpat); f != filters.end())
+        f->second.add(k);
+}
+
+// Tells if the key is surely not in the current DB, by its Bloom
+// filter; then sets the status as the descent would. The filter is
+// built here rather than as the DB is opened, for the DBs opened only
+// to be written or to be made anew not to be gone through.
+bool MarsImpl::surely_absent(uint64_t k) {
+    if (k == 0 || k & ONEBIT(48) || !mars.bloom_bits || !IOpat)
+        return false;
+    auto f = filters.find(IOpat);
+    if (f == filters.end() || f->second.stale()) {
+        try {
+            if (bdtab[0] != DBkey && IOpat) {
+                IOcall(ONEBIT(40) | IOpat, bdtab);
+            }
+            build_filter();
+        } catch (Error) {
+            filters.erase(IOpat);
+        }
+        // The build has moved the cursor, the descent is to set it
+        return false;
+    }
+    if (f->second.may_have(k))
+        return false;
+    mars.errmsg = msg[Mars::ERR_NO_NAME-1];
+    mars.status = Mars::ERR_NO_NAME;
+    return true;
+}
+
+// Advances the scan to the next record and reads its value
+void MarsImpl::scan_step(Mars::Scan & s) try {
+    if (s.db != IOpat)
+        throw Mars::ERR_NO_CURR;
+    // For step() to throw at the end
+    curcmd = 0;
+    bool intact = s.generation == generation;
+    ++generation;
+    if (!intact) {
+        if (bdtab[0] != DBkey && IOpat) {
+            IOcall(ONEBIT(40) | IOpat, bdtab);
+        }
+        find(s.from);
+        if (curkey < s.from)
+            step(0);
+    } else {
+        step(0);
+    }
+    if (curkey >= s.hi)
+        throw Mars::ERR_NO_NEXT;
+    // Lookahead: the zones of the next datum and of the next leaf
+    auto pos = Cursor[idx].pos;
+    if (pos + 1 < int(curMetaBlock->header.len/2))
+        prefetch(curMetaBlock->element[pos+1].id);
+    else
+        prefetch(curMetaBlock->header.next);
+    info(workHandle);
+    s.value.resize(datumLen);
+    auto usrloc = s.value.data();
+    ++extPtr;
+    --extLength;
+    copy_chained(extLength, usrloc);
+    s.entry = Mars::Entry{curkey, s.value};
+    s.from = curkey + 1;
+    s.generation = generation;
+    mars.errmsg = nullptr;
+    mars.status = Mars::ERR_SUCCESS;
+} catch (Error e) {
+    s.done = true;
+    if (e == Mars::ERR_NO_NEXT) {
+        mars.errmsg = nullptr;
+        mars.status = Mars::ERR_SUCCESS;
+    } else {
+        std::cerr << std::format("ERROR {} ({})\n", int(e), msg[e-1]);
+        mars.errmsg = msg[e-1];
+        mars.status = e;
+    }
 }
 
 static int to_lnuzzzz(int lun, int start, int len) {
@@ -1564,6 +2847,8 @@ Error Mars::modd(uint64_t k, uint64_t *loc, int len) {
 }
 
 Error Mars::getd(const char * k, uint64_t *loc, int len) {
+    if (impl.surely_absent(*reinterpret_cast<const uint64_t*>(k)))
+        return status;
     impl.key = *reinterpret_cast<const uint64_t*>(k);
     impl.mylen = len;
     impl.myloc = loc;
@@ -1575,6 +2860,8 @@ Error Mars::getd(uint64_t k, uint64_t *loc, int len) {
     if (verbose) {
         std::cerr << std::format("Running getd({:016o}, {}:{})\n", k, (void*)loc, len);
     }
+    if (impl.surely_absent(k))
+        return status;
     impl.key = k;
     impl.mylen = len;
     impl.myloc = loc;
@@ -1583,12 +2870,16 @@ Error Mars::getd(uint64_t k, uint64_t *loc, int len) {
 }
 
 Error Mars::deld(const char * k) {
+    if (impl.surely_absent(*reinterpret_cast<const uint64_t*>(k)))
+        return status;
     impl.key = *reinterpret_cast<const uint64_t*>(k);
     impl.orgcmd = mcprog(OP_FIND, OP_MATCH, OP_FREE, OP_DELKEY);
     return impl.eval();
 }
 
 Error Mars::deld(uint64_t k) {
+    if (impl.surely_absent(k))
+        return status;
     impl.idx = 0;
     impl.key = k;
     impl.orgcmd = mcprog(OP_FIND, OP_MATCH, OP_FREE, OP_DELKEY);
@@ -1663,6 +2954,36 @@ int Mars::avail() {
     return impl.datumLen;
 }
 
+auto Mars::scan(uint64_t lo, uint64_t hi) -> Scan {
+    Scan s(*this, lo, hi);
+    s.db = impl.IOpat;
+    return s;
+}
+
+void Mars::Scan::step() {
+    mars.impl.scan_step(*this);
+}
+
+bool Mars::defrag(std::chrono::microseconds slice) {
+    return impl.defrag(slice);
+}
+
+Error Mars::bulk_load(std::span<const Record> records) {
+    return impl.bulk_load(records);
+}
+
+Error Mars::begin() {
+    return impl.begin();
+}
+
+Error Mars::commit() {
+    return impl.commit();
+}
+
+Error Mars::rollback() {
+    return impl.rollback();
+}
+
 Error Mars::eval(uint64_t microcode) {
     impl.orgcmd = microcode;
     return impl.eval();
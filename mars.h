@@ -1,10 +1,14 @@
 #ifndef MARS_H
 #define MARS_H
 
+#include <chrono>
 #include <cstdint>
 #include <string>
 #include <algorithm>
 #include <memory>
+#include <span>
+#include <vector>
+#include <iterator>
 
 class Mars {
     struct MarsImpl & impl;
@@ -231,16 +235,181 @@ class Mars {
 
     uint64_t first(), last(), prev(), next();
 
+    // Iterates over the records with lo <= key < hi in the order of keys,
+    // yielding the keys with the values, which stay valid until the next
+    // step. A step goes on from the cursor of the previous one, unless
+    // the DB has been used otherwise in between; then the scan resumes
+    // after the last key seen. At the end, status is set as usual.
+    // A scan is over the DB current when it is made; if another DB
+    // is current at a step, the scan ends with ERR_NO_CURR.
+    struct Entry {
+        uint64_t key;
+        std::span<const uint64_t> value;
+    };
+    class Scan {
+        friend class Mars;
+        friend struct MarsImpl;
+        Mars & mars;
+        uint64_t from, hi;      // the next key to look for, the limit
+        uint64_t generation;    // of the cursor when left by the scan
+        uint64_t db;            // the IOpat of the DB
+        bool done = false;
+        std::vector<uint64_t> value;
+        Entry entry;
+        Scan(Mars & m, uint64_t lo, uint64_t hi_) :
+            mars(m), from(std::max<uint64_t>(lo, 1)), hi(hi_), generation(~0ULL) { }
+      public:
+        class iterator {
+            friend class Scan;
+            Scan * scan;
+            iterator(Scan * s) : scan(s) { }
+          public:
+            using value_type = Entry;
+            using difference_type = std::ptrdiff_t;
+            iterator() : scan(nullptr) { }
+            const Entry & operator*() const { return scan->entry; }
+            const Entry * operator->() const { return &scan->entry; }
+            iterator & operator++() { scan->step(); return *this; }
+            void operator++(int) { scan->step(); }
+            bool operator==(std::default_sentinel_t) const { return scan->done; }
+        };
+        iterator begin() { step(); return iterator(this); }
+        std::default_sentinel_t end() { return {}; }
+      private:
+        void step();
+    };
+    Scan scan(uint64_t lo, uint64_t hi = uint64_t(1) << 47);
+
     uint64_t find(const char * k), find(uint64_t k);
 
     int getlen(), avail();
 
+    // Loads the records, in the increasing order of keys, into the current
+    // DB, which must be new: the data are packed zone by zone, and the
+    // metadata blocks are built bottom-up, three quarters full, leaving
+    // room for the inserts to come. Unless in a transaction,
+    // the DB remains empty if the load fails.
+    struct Record {
+        uint64_t key;
+        const uint64_t * loc;
+        int len;
+    };
+    Error bulk_load(std::span<const Record> records);
+
+    // Goes through the records of the current DB in the order of keys
+    // for about 'slice', moving the chained data into single extents
+    // where a zone has room for them, and returns whether the end
+    // has been reached or an error has stopped it, telling them apart
+    // by status; the next call continues where the previous has stopped,
+    // or starts over after the end or the error.
+    bool defrag(std::chrono::microseconds slice);
+
+    // Transactions: the changes made by the calls after begin() are
+    // written to the zones together by commit(), which also flushes them
+    // (or logs them, see redo_log) if the Mars is persistent,
+    // or are discarded by rollback().
+    // Transactions do not nest; an open transaction is rolled back
+    // when the Mars is destroyed.
+    Error begin(), commit(), rollback();
+
     bdvect_t & bdvect() { return bdv; }
 
+    // Where zone images are kept: one file per zone, named after
+    // the LUN and the zone number in octal (e.g. 520001), one
+    // memory-mapped file per LUN (e.g. 52.lun) holding all its zones,
+    // or in memory only. Takes effect at the first InitDB or SetDB.
+    enum Storage { ZONE_FILES, LUN_FILES, MEMORY };
+    Storage storage = ZONE_FILES;
+
+    // Keeps the zone images, identified by their I/O addresses
+    // (the LUN in bits 12-17, the zone number in bits 0-11).
+    // An image must stay in place as long as the zone exists.
+    struct Backend {
+        virtual ~Backend() = default;
+        // Returns the image of a zone, nullptr if the zone does not exist
+        virtual uint64_t * read(unsigned addr) = 0;
+        // Returns the image of a zone to be changed, zero-filled if new
+        virtual uint64_t * write(unsigned addr) = 0;
+        // Makes a zone not exist, when its creation is rolled back
+        virtual void remove(unsigned addr) = 0;
+        // Writes out a changed zone, durably if 'sync' is set
+        virtual void flush(unsigned addr, bool sync) = 0;
+        // Hints that a zone will be read soon
+        virtual void prefetch(unsigned) { }
+    };
+    // Set up according to 'storage' by the first InitDB or SetDB,
+    // unless provided by the user
+    std::unique_ptr<Backend> backend;
+
+    // Whether the zone of the next (or, stepping back, the previous)
+    // metadata block is prefetched when stepping through the records,
+    // once the cursor is within prefetch_distance keys of the edge of
+    // its block, and the zone of the next extent when reading chained data
+    bool prefetch = false;
+    unsigned prefetch_distance = 040;
+
+    // Number of page frames in the buffer pool for the data zones
+    // (all zones but zone 0 of the current DB, which has its own buffer).
+    // Takes effect at the next InitDB or SetDB.
+    unsigned buffers = 8;
+
+    // Whether InitDB and newd make the DBs with wide metadata blocks,
+    // splitting at 0400 keys instead of 040, for shallower trees.
+    // Such DBs cannot be read by the original implementation.
+    bool wide_blocks = false;
+
+    // Whether a key is looked for in the leaf metadata block of the
+    // previous insert, if it falls there, before descending from the root;
+    // this pays off when the keys are inserted in increasing order.
+    bool append = false;
+
+    // Bits per key of the Bloom filters of the keys of the DBs, built
+    // at the first getd or deld in a DB, by which getd and deld tell
+    // an absent key without the descent (and leave the cursor as it was);
+    // 0 for none. Takes effect at the next InitDB, SetDB or opend.
+    unsigned bloom_bits = 0;
+
+    // A secondary metadata block left with fewer keys than this after
+    // a deletion is merged with a neighbour under the same parent block,
+    // if both fit in one with room to spare, and a root block pointing
+    // to a single small block takes its keys, making the tree shallower.
+    // 0 keeps the original behaviour of freeing only the empty blocks.
+    unsigned merge_below = 0;
+
+    // Name of the redo log of a persistent Mars, none if empty.
+    // With the log, the words changed by each call outside a transaction,
+    // or by a transaction, are appended to the log instead of writing
+    // the zones, which are written when the log grows over log_limit
+    // bytes and when the Mars is destroyed. A log left by a crash
+    // is replayed at the next InitDB or SetDB.
+    std::string redo_log;
+    size_t log_limit = 1 << 20;
+
+    // How a key is looked up in a metadata block: scanning down from
+    // the last element, by bisection, or counting the keys not above it,
+    // a loop without branches that the compiler may vectorize.
+    enum KeySearch { LINEAR_SEARCH, BINARY_SEARCH, COUNTING_SEARCH };
+    KeySearch key_search = LINEAR_SEARCH;
+
+    // Where a datum or a metadata block that fits in a zone goes: the
+    // current zone if it fits, otherwise the first zone that fits; the zone
+    // with the least room that fits, against fragmentation; or the zone
+    // nearest to the metadata block read last, which keeps the data
+    // next to their leaf. The data that fit nowhere are split in any case.
+    enum AllocPolicy { FIRST_FIT, BEST_FIT, NEAR_FIT };
+    AllocPolicy alloc_policy = FIRST_FIT;
+
+    // Dump the zones written out in text format as well, to a .txt file
+    // per zone (e.g. 520001.txt), or appending them all to dump_file
+    // if it is set, where the later lines for a zone supersede the earlier.
     bool dump_txt_zones = false;
+    std::string dump_file;
     bool verbose = false;
     bool zero_date = false;
     bool dump_diffs = false;
+    // Whether the usable space kept along with the free space array
+    // is checked against its sum whenever it is used
+    bool check_space = false;
     Error status;
     const char * errmsg;        // nullptr when status is ERR_SUCCESS
 private:
@@ -3,6 +3,7 @@
 #include <set>
 #include <numeric>
 #include <fstream>
+#include <chrono>
 #include <format>
 #include <gtest/gtest.h>
 
@@ -106,3 +107,72 @@ TEST(mars, stepdel)
         sum += cur;
     EXPECT_EQ(sum, std::accumulate(gold.begin(), --gold.end(), 0));
 }
+
+// Fills a DB as in 'clear', then looks up the present and absent keys;
+// returns the keys found, and reports the time taken by the lookups
+static std::vector<uint64_t> lookup(Mars::KeySearch how)
+{
+    using namespace std::chrono;
+    Mars mars(false);
+    mars.storage = Mars::MEMORY;
+    mars.key_search = how;
+    mars.InitDB(052, 0, 0427);
+    mars.SetDB(052, 0, 0427);
+    for (int i = 1; i < 65535; ++i) {
+        EXPECT_EQ(mars.putd(i * 2, 0, 0), Mars::ERR_SUCCESS);
+    }
+    auto start = steady_clock::now();
+    std::vector<uint64_t> found;
+    for (int rep = 0; rep < 4; ++rep) {
+        for (int i = 1; i < 131070; ++i)
+            found.push_back(mars.find(i * 7 % 131071));
+    }
+    std::cerr << std::format("Search {}: {} ms\n", int(how),
+                             duration_cast<milliseconds>(steady_clock::now() - start).count());
+    return found;
+}
+
+TEST(mars, keysearch)
+{
+    auto gold = lookup(Mars::LINEAR_SEARCH);
+    EXPECT_EQ(lookup(Mars::BINARY_SEARCH), gold);
+    EXPECT_EQ(lookup(Mars::COUNTING_SEARCH), gold);
+}
+
+TEST(mars, wideblocks)
+{
+    std::string result;
+    run_command(result, "rm -f 52????");
+    std::set<uint64_t> gold;
+    {
+        Mars mars(true);
+        mars.wide_blocks = true;
+        mars.InitDB(052, 0, 01731);
+        mars.SetDB(052, 0, 01731);
+        // Beyond what the original format can hold
+        for (int i = 1; i <= 100000; ++i) {
+            uint64_t k = i * 7919 % 100003;
+            gold.insert(k);
+            ASSERT_EQ(mars.putd(k, &k, 1), Mars::ERR_SUCCESS) << "key " << k;
+        }
+        for (int i = 1; i <= 100000; i += 3) {
+            uint64_t k = i * 7919 % 100003;
+            gold.erase(k);
+            ASSERT_EQ(mars.deld(k), Mars::ERR_SUCCESS) << "key " << k;
+        }
+    }
+    // The format is taken from the DB
+    Mars mars(false);
+    ASSERT_EQ(mars.SetDB(052, 0, 01731), Mars::ERR_SUCCESS);
+    auto it = gold.begin();
+    for (auto k = mars.first(); !mars.status; k = mars.next(), ++it) {
+        ASSERT_NE(it, gold.end());
+        ASSERT_EQ(k, *it);
+    }
+    EXPECT_EQ(it, gold.end());
+    uint64_t got;
+    for (auto k : gold) {
+        ASSERT_EQ(mars.getd(k, &got, 1), Mars::ERR_SUCCESS);
+        ASSERT_EQ(got, k);
+    }
+}
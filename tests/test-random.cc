@@ -1,6 +1,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
+#include <map>
 #include <format>
 #include <gtest/gtest.h>
 
@@ -101,3 +102,362 @@ After clearing: 65228
 )";
     EXPECT_EQ(result, expect);
 }
+
+TEST(mars, merge)
+{
+    Mars mars(false);
+    mars.storage = Mars::MEMORY;
+    mars.merge_below = 8;
+    mars.InitDB(052, 0, 0400);
+    mars.SetDB(052, 0, 0400);
+    int space = mars.avail();
+    std::map<uint64_t, uint64_t> expect;
+    uint64_t data[1];
+    srandom(3);
+    for (int rep = 0; rep < 4; ++rep) {
+        // Growing the tree, then thinning it out
+        for (int i = 0; i < 40000; ++i) {
+            uint64_t k = random() % 20000 + 1;
+            if (rep % 2 ? random() % 4 : !(random() % 4)) {
+                ASSERT_EQ(mars.deld(k) == Mars::ERR_SUCCESS, expect.erase(k) == 1) << k;
+            } else {
+                data[0] = i;
+                ASSERT_EQ(mars.modd(k, data, 1), Mars::ERR_SUCCESS);
+                expect[k] = i;
+            }
+        }
+        auto it = expect.begin();
+        for (auto & e : mars.scan(0)) {
+            ASSERT_NE(it, expect.end());
+            ASSERT_EQ(e.key, it->first);
+            ASSERT_EQ(e.value[0], it->second);
+            ++it;
+        }
+        EXPECT_EQ(it, expect.end());
+    }
+    for (auto [k, v] : expect)
+        ASSERT_EQ(mars.deld(k), Mars::ERR_SUCCESS);
+    // No metadata blocks are left behind
+    EXPECT_EQ(mars.avail(), space);
+}
+
+TEST(mars, defrag)
+{
+    Mars mars(false);
+    mars.storage = Mars::MEMORY;
+    mars.InitDB(052, 0, 020);
+    mars.SetDB(052, 0, 020);
+    std::map<uint64_t, std::vector<uint64_t>> expect;
+    // Churning records of up to a half zone, filling about half the DB;
+    // some of them end up chained
+    srandom(1);
+    for (int i = 0; i < 5000; ++i) {
+        uint64_t k = random() % 40 + 1;
+        if (random() % 3 == 0) {
+            mars.deld(k);
+            expect.erase(k);
+            continue;
+        }
+        std::vector<uint64_t> data(random() % 500);
+        for (auto & w : data)
+            w = random();
+        if (mars.modd(k, data.data(), data.size()) == Mars::ERR_SUCCESS) {
+            expect[k] = data;
+        } else {
+            // The record may have been left as it was
+            data.resize(500);
+            if (mars.getd(k, data.data(), data.size()) == Mars::ERR_SUCCESS) {
+                data.resize(mars.getlen());
+                ASSERT_EQ(expect.at(k), data) << k;
+            } else {
+                expect.erase(k);
+            }
+        }
+    }
+    int space = mars.avail();
+    int slices = 0;
+    while (!mars.defrag(std::chrono::microseconds(0)))
+        ++slices;
+    ASSERT_EQ(mars.status, Mars::ERR_SUCCESS);
+    // An element in each slice, the key 0 of the first leaf included
+    EXPECT_EQ(slices, int(expect.size()) + 1);
+    // Each extent but the first of a datum has taken a word
+    EXPECT_GT(mars.avail(), space);
+    std::vector<uint64_t> got(500);
+    for (auto & [k, data] : expect) {
+        ASSERT_EQ(mars.getd(k, got.data(), got.size()), Mars::ERR_SUCCESS) << k;
+        ASSERT_EQ(mars.getlen(), int(data.size()));
+        ASSERT_TRUE(std::equal(data.begin(), data.end(), got.begin())) << k;
+    }
+}
+
+// Churns records of random sizes with the allocation policy,
+// filling the DB about half, and reads them back
+static void churn(Mars::AllocPolicy policy)
+{
+    Mars mars(false);
+    mars.storage = Mars::MEMORY;
+    mars.alloc_policy = policy;
+    mars.check_space = true;
+    mars.InitDB(052, 0, 040);
+    mars.SetDB(052, 0, 040);
+    std::map<uint64_t, std::vector<uint64_t>> expect;
+    srandom(2);
+    for (int i = 0; i < 20000; ++i) {
+        uint64_t k = random() % 150 + 1;
+        if (i % 4 == 3) {
+            mars.deld(k);
+            expect.erase(k);
+            continue;
+        }
+        std::vector<uint64_t> data(random() % 300, i);
+        ASSERT_EQ(mars.modd(k, data.data(), data.size()), Mars::ERR_SUCCESS);
+        expect[k] = data;
+    }
+    std::vector<uint64_t> got(300);
+    for (auto & [k, data] : expect) {
+        ASSERT_EQ(mars.getd(k, got.data(), got.size()), Mars::ERR_SUCCESS) << k;
+        ASSERT_TRUE(std::equal(data.begin(), data.end(), got.begin())) << k;
+    }
+}
+
+TEST(mars, policies)
+{
+    for (auto policy : { Mars::FIRST_FIT, Mars::BEST_FIT, Mars::NEAR_FIT }) {
+        SCOPED_TRACE(policy);
+        churn(policy);
+    }
+}
+
+// Returns the last of the first 'zones' zones of the DB with the word
+static int zone_with(Mars & mars, int zones, uint64_t w)
+{
+    int found = -1;
+    for (int zone = 0; zone < zones; ++zone) {
+        const uint64_t * p = mars.backend->read(052 << 12 | zone);
+        if (p && std::find(p, p + 1024, w) != p + 1024)
+            found = zone;
+    }
+    return found;
+}
+
+TEST(mars, bestfit)
+{
+    for (auto policy : { Mars::FIRST_FIT, Mars::BEST_FIT, Mars::NEAR_FIT }) {
+        SCOPED_TRACE(policy);
+        Mars mars(false);
+        mars.storage = Mars::MEMORY;
+        mars.InitDB(052, 0, 6);
+        mars.SetDB(052, 0, 6);
+        // Leaving about 280, 220, 420 and 120 free words in zones 0-3,
+        // and zones 4-5 empty
+        int sizes[] = {700, 800, 600, 900};
+        for (int k = 0; k < 4; ++k) {
+            std::vector<uint64_t> data(sizes[k], 0770000 + k);
+            ASSERT_EQ(mars.putd(k + 1, data.data(), data.size()), Mars::ERR_SUCCESS);
+            ASSERT_EQ(zone_with(mars, 6, 0770000 + k), k);
+        }
+        mars.alloc_policy = policy;
+        std::vector<uint64_t> data(150, 0777777);
+        ASSERT_EQ(mars.putd(5, data.data(), data.size()), Mars::ERR_SUCCESS);
+        // The first zone that fits, the one with the least room that fits;
+        // with the root as the only metadata block, nearness is no concern
+        EXPECT_EQ(zone_with(mars, 6, 0777777), policy == Mars::BEST_FIT ? 1 : 0);
+    }
+}
+
+TEST(mars, nearfit)
+{
+    int zones[2];
+    for (auto policy : { Mars::FIRST_FIT, Mars::NEAR_FIT }) {
+        SCOPED_TRACE(policy);
+        Mars mars(false);
+        mars.storage = Mars::MEMORY;
+        mars.InitDB(052, 0, 040);
+        mars.SetDB(052, 0, 040);
+        // The leaves fill the zones with the empty records; then there is
+        // room only in the first zones and in the zones of the last leaves
+        for (uint64_t k = 1; k <= 3000; ++k)
+            ASSERT_EQ(mars.putd(k * 4, nullptr, 0), Mars::ERR_SUCCESS);
+        for (uint64_t k = 1; k <= 3000; ++k) {
+            if (k <= 300 || (k > 2600 && k % 3)) {
+                ASSERT_EQ(mars.deld(k * 4), Mars::ERR_SUCCESS);
+            }
+        }
+        mars.alloc_policy = policy;
+        std::vector<uint64_t> data(40, 0777777);
+        ASSERT_EQ(mars.putd(2000 * 4 + 1, data.data(), data.size()), Mars::ERR_SUCCESS);
+        int leaf = zone_with(mars, 040, 2000 * 4 + 1);
+        zones[policy == Mars::NEAR_FIT] = zone_with(mars, 040, 0777777);
+        if (policy == Mars::FIRST_FIT) {
+            EXPECT_EQ(zones[0], 0);
+        } else {
+            // The leaf zone is full, the nearest zone with room is above
+            EXPECT_GT(zones[1], leaf);
+            EXPECT_LT(zones[1] - leaf, leaf - zones[0]);
+        }
+    }
+}
+
+TEST(mars, bulkload)
+{
+    srandom(5);
+    for (bool wide : {false, true}) {
+        Mars mars(false);
+        mars.storage = Mars::MEMORY;
+        mars.wide_blocks = wide;
+        mars.InitDB(052, 0, 0400);
+        mars.SetDB(052, 0, 0400);
+        const int numrec = 12000;
+        std::vector<uint64_t> data(numrec * 10);
+        std::vector<Mars::Record> records;
+        for (int i = 0; i < numrec; ++i) {
+            data[i * 10] = i;
+            records.push_back({uint64_t(i + 1) * 4, &data[i * 10], int(random() % 10)});
+        }
+        std::vector<Mars::Record> unsorted{records[1], records[0]};
+        EXPECT_EQ(mars.bulk_load(unsorted), Mars::ERR_INV_NAME);
+        ASSERT_EQ(mars.bulk_load(records), Mars::ERR_SUCCESS);
+        EXPECT_EQ(mars.bulk_load(records), Mars::ERR_EXISTS);
+
+        // The loaded tree takes the usual inserts and deletions
+        uint64_t got[10];
+        for (int i = 0; i < numrec; ++i) {
+            auto k = random() % (numrec * 4) + 1;
+            if (k % 4 == 2)
+                ASSERT_EQ(mars.modd(k, got, 3), Mars::ERR_SUCCESS) << k;
+            else if (k % 4 == 0 && records[k / 4 - 1].len >= 0) {
+                ASSERT_EQ(mars.deld(k), Mars::ERR_SUCCESS) << k;
+                records[k / 4 - 1].len = -1;
+            }
+        }
+        int n = 0;
+        for (auto k = mars.first(); !mars.status; k = mars.next()) {
+            if (k % 4 == 0) {
+                auto & r = records[k / 4 - 1];
+                ASSERT_GE(r.len, 0) << k;
+                ASSERT_EQ(mars.getd(k, got, 10), Mars::ERR_SUCCESS) << k;
+                ASSERT_EQ(mars.getlen(), r.len);
+                ASSERT_TRUE(std::equal(r.loc, r.loc + r.len, got)) << k;
+                // getd has moved the cursor
+                mars.find(k);
+                ++n;
+            }
+        }
+        EXPECT_EQ(n, std::count_if(records.begin(), records.end(),
+                                   [](auto & r) { return r.len >= 0; }));
+    }
+}
+
+// Inserts keys mostly in increasing order, with some going back
+// and some deletions; returns the keys found and the zone images
+static std::vector<uint64_t> ingest(bool append)
+{
+    Mars mars(false);
+    mars.storage = Mars::MEMORY;
+    mars.zero_date = true;
+    mars.append = append;
+    mars.InitDB(052, 0, 0200);
+    mars.SetDB(052, 0, 0200);
+    uint64_t data[4] = {1, 2, 3, 4};
+    std::vector<uint64_t> result;
+    srandom(17);
+    for (int i = 1; i <= 20000; ++i) {
+        uint64_t k = 1000 + i * 4 - (random() % 50 == 0 ? random() % 1000 : 0);
+        mars.putd(k, data, i % 5);
+        if (i % 97 == 0)
+            mars.deld(k - 8);
+        if (i % 1000 == 0)
+            result.push_back(mars.find(i * 2));
+    }
+    for (auto k = mars.first(); !mars.status; k = mars.next())
+        result.push_back(k);
+    for (unsigned zone = 0; zone < 0200; ++zone) {
+        uint64_t * w = mars.backend->read(052 << 12 | zone);
+        result.insert(result.end(), w, w + 1024);
+    }
+    return result;
+}
+
+TEST(mars, append)
+{
+    EXPECT_EQ(ingest(true), ingest(false));
+}
+
+TEST(mars, appendfiles)
+{
+    // The leaf of the last insert is not to be used in another DB
+    Mars mars(false);
+    mars.storage = Mars::MEMORY;
+    mars.append = true;
+    mars.InitDB(052, 0, 4);
+    mars.SetDB(052, 0, 4);
+    uint64_t data[4] = {1, 2, 3, 4}, got[4];
+    auto name = [](int i) { return Mars::tobesm(std::format("F{:03}", i)); };
+    for (int i = 0; i < 300; ++i) {
+        uint64_t n = name(i);
+        auto fname = reinterpret_cast<const char*>(&n);
+        ASSERT_EQ(mars.newd(fname, 052, 4 + i, 1), Mars::ERR_SUCCESS) << i;
+        ASSERT_EQ(mars.opend(fname), Mars::ERR_SUCCESS) << i;
+        for (uint64_t k = 1; k <= 20; ++k)
+            ASSERT_EQ(mars.putd(k, data, 4), Mars::ERR_SUCCESS) << i;
+    }
+    for (int i = 0; i < 300; ++i) {
+        uint64_t n = name(i);
+        ASSERT_EQ(mars.opend(reinterpret_cast<const char*>(&n)), Mars::ERR_SUCCESS) << i;
+        for (uint64_t k = 1; k <= 20; ++k)
+            ASSERT_EQ(mars.getd(k, got, 4), Mars::ERR_SUCCESS) << i;
+        EXPECT_EQ(mars.last(), 20u) << i;
+    }
+}
+
+TEST(mars, bloom)
+{
+    Mars plain(false), mars(false);
+    mars.bloom_bits = 10;
+    for (Mars * m : {&plain, &mars}) {
+        m->storage = Mars::MEMORY;
+        m->zero_date = true;
+        m->InitDB(052, 0, 0200);
+        m->SetDB(052, 0, 0200);
+    }
+    uint64_t data[4] = {1, 2, 3, 4}, got[4], expect[4];
+    srandom(5);
+    for (int i = 0; i < 60000; ++i) {
+        if (i == 20000 || i == 40000) {
+            // The filter is built from the DB, it must know all the keys
+            ASSERT_EQ(mars.SetDB(052, 0, 0200), Mars::ERR_SUCCESS);
+            ASSERT_EQ(plain.SetDB(052, 0, 0200), Mars::ERR_SUCCESS);
+            for (uint64_t k = 1; k <= 20000; ++k) {
+                ASSERT_EQ(mars.getd(k, got, 4), plain.getd(k, expect, 4)) << k;
+                if (!mars.status) {
+                    ASSERT_TRUE(std::equal(got, got + 4, expect)) << k;
+                }
+            }
+        }
+        uint64_t k = random() % 20000 + 1;
+        switch (random() % 8) {
+        case 0:
+            data[0] = i;
+            ASSERT_EQ(mars.modd(k, data, 4), plain.modd(k, data, 4));
+            break;
+        case 1:
+            ASSERT_EQ(mars.deld(k), plain.deld(k)) << k;
+            break;
+        default:
+            ASSERT_EQ(mars.getd(k, got, 4), plain.getd(k, expect, 4)) << k;
+            if (!mars.status) {
+                ASSERT_TRUE(std::equal(got, got + 4, expect)) << k;
+            }
+        }
+    }
+    // Skipping the descent may change where the data go, but not the data
+    auto a = mars.scan(0), b = plain.scan(0);
+    auto j = b.begin();
+    for (auto i = a.begin(); i != a.end(); ++i, ++j) {
+        ASSERT_NE(j, b.end());
+        ASSERT_EQ(i->key, j->key);
+        ASSERT_TRUE(std::ranges::equal(i->value, j->value));
+    }
+    EXPECT_EQ(j, b.end());
+}
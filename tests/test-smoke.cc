@@ -79,6 +79,94 @@ EOF
     EXPECT_TRUE(result.empty());
 }
 
+TEST(mars, readonly)
+{
+    Mars & mars = *new Mars;
+    std::string before, after;
+    uint64_t data[3] = { 1, 2, 3 };
+    run_command(before, "rm -f 520000");
+    mars.InitDB(052, 0, 1);
+    mars.SetDB(052, 0, 1);
+    ASSERT_EQ(mars.putd(12345, data, 3), Mars::ERR_SUCCESS);
+    delete &mars;
+    // Zones which were only read must not be written back
+    run_command(before, "stat -c %y 520000");
+    Mars & reader = *new Mars;
+    reader.SetDB(052, 0, 1);
+    EXPECT_EQ(reader.getd(12345, data, 3), Mars::ERR_SUCCESS);
+    delete &reader;
+    run_command(after, "stat -c %y 520000");
+    EXPECT_EQ(before, after);
+}
+
+TEST(mars, lunfile)
+{
+    Mars & mars = *new Mars;
+    std::string result;
+    run_command(result, "rm -f 52.lun");
+    ASSERT_EQ(result, "");
+    mars.storage = Mars::LUN_FILES;
+    mars.zero_date = true;
+    mars.InitDB(052, 0, 3);
+    delete &mars;
+    // The zones must be the same as in the one-file-per-zone format
+    run_command(result, R"(for z in 0 1 2; do
+dd if=52.lun bs=8192 skip=$z count=1 2>/dev/null | sha1sum
+done)");
+    EXPECT_EQ(result, "76948c7d9cf5a68f7ba3b9c804c317d2ce904424  -\n"
+              "3ada2ada7dc333451e34e7641d8190d55bbcca46  -\n"
+              "2ec94808d03eea091b0548f4f42b85ad1a734814  -\n");
+
+    // The data must survive reopening
+    uint64_t data[3] = { 1, 2, 3 }, back[3] = { };
+    Mars & m2 = *new Mars;
+    m2.storage = Mars::LUN_FILES;
+    ASSERT_EQ(m2.SetDB(052, 0, 3), Mars::ERR_SUCCESS);
+    ASSERT_EQ(m2.putd(12345, data, 3), Mars::ERR_SUCCESS);
+    delete &m2;
+    Mars m3(false);
+    m3.storage = Mars::LUN_FILES;
+    ASSERT_EQ(m3.SetDB(052, 0, 3), Mars::ERR_SUCCESS);
+    ASSERT_EQ(m3.getd(12345, back, 3), Mars::ERR_SUCCESS);
+    EXPECT_TRUE(compare(back, data, 3));
+}
+
+TEST(mars, memory)
+{
+    Mars & mars = *new Mars;
+    std::string result;
+    run_command(result, "rm -f 520000 52.lun");
+    mars.storage = Mars::MEMORY;
+    mars.InitDB(052, 0, 3);
+    uint64_t data[3] = { 1, 2, 3 }, back[3] = { };
+    ASSERT_EQ(mars.SetDB(052, 0, 3), Mars::ERR_SUCCESS);
+    ASSERT_EQ(mars.putd(12345, data, 3), Mars::ERR_SUCCESS);
+    ASSERT_EQ(mars.SetDB(052, 0, 3), Mars::ERR_SUCCESS);
+    ASSERT_EQ(mars.getd(12345, back, 3), Mars::ERR_SUCCESS);
+    EXPECT_TRUE(compare(back, data, 3));
+    delete &mars;
+    // Nothing is written to files
+    run_command(result, "ls 520000 52.lun 2>/dev/null | wc -l");
+    EXPECT_EQ(result, "0\n");
+}
+
+TEST(mars, textdump)
+{
+    std::string result;
+    run_command(result, "rm -f 52000[0-2].txt 52.txt");
+    for (const char * file : { "", "52.txt" }) {
+        Mars & mars = *new Mars;
+        mars.zero_date = true;
+        mars.dump_txt_zones = true;
+        mars.dump_file = file;
+        mars.InitDB(052, 0, 3);
+        delete &mars;
+    }
+    // The same text either way
+    run_command(result, "cat 52000[0-2].txt | cmp - 52.txt && sed -n 2p 52.txt");
+    EXPECT_EQ(result, "0000.0001:  0000 0000 0000 5731\n");
+}
+
 TEST(mars, coverage)
 {
     Mars & mars = *new Mars;
@@ -140,6 +228,88 @@ TEST(mars, coverage)
 )");
 }
 
+// Puts and deletes values spanning several zones, returns the checksums of the zones
+static std::string churn(unsigned buffers)
+{
+    Mars & mars = *new Mars;
+    std::string result;
+    run_command(result, "rm -f 520[0-1]??");
+    mars.zero_date = true;
+    mars.buffers = buffers;
+    mars.InitDB(052, 0, 0200);
+    mars.SetDB(052, 0, 0200);
+    uint64_t data[1500];
+    init(mars, data, 1500);
+    for (int i = 1; i <= 100; ++i) {
+        EXPECT_EQ(mars.putd(i, data, i * 37 % 1500), Mars::ERR_SUCCESS);
+    }
+    for (int i = 1; i <= 100; i += 3) {
+        EXPECT_EQ(mars.deld(i), Mars::ERR_SUCCESS);
+    }
+    for (int i = 2; i <= 100; i += 3) {
+        EXPECT_EQ(mars.modd(i, data, i * 53 % 1500), Mars::ERR_SUCCESS);
+    }
+    delete &mars;
+    run_command(result, "sha1sum 520[0-1]?? | sha1sum");
+    return result;
+}
+
+TEST(mars, pool)
+{
+    // The size of the buffer pool must not affect the images
+    std::string one = churn(1);
+    EXPECT_EQ(churn(2), one);
+    EXPECT_EQ(churn(64), one);
+}
+
+// Scans a DB of many records and of chained data with prefetching,
+// forward or backward, returns the number of records seen
+static int scan(Mars::Storage storage, bool backward = false)
+{
+    Mars mars(false);
+    mars.storage = storage;
+    mars.prefetch = true;
+    mars.prefetch_distance = 4;
+    uint64_t data[3000], back[3000];
+    init(mars, data, 3000);
+    EXPECT_EQ(mars.SetDB(052, 0, 0200), Mars::ERR_SUCCESS);
+    int count = 0;
+    // At the end, next() fails leaving the last key,
+    // and prev() arrives at the 0 key of the first metadata block
+    for (uint64_t k = backward ? mars.last() : mars.first(); k && mars.status == Mars::ERR_SUCCESS;
+         k = backward ? mars.prev() : mars.next()) {
+        int len = k <= 5 ? 3000 : k % 20;
+        EXPECT_EQ(mars.getd(k, back, len), Mars::ERR_SUCCESS);
+        EXPECT_TRUE(compare(back, data, len)) << "key " << k;
+        ++count;
+    }
+    return count;
+}
+
+TEST(mars, prefetch)
+{
+    std::string result;
+    run_command(result, "rm -f 520[0-1]?? 52.lun");
+    uint64_t data[3000];
+    for (auto storage : { Mars::ZONE_FILES, Mars::LUN_FILES }) {
+        Mars & mars = *new Mars;
+        mars.storage = storage;
+        init(mars, data, 3000);
+        mars.InitDB(052, 0, 0200);
+        mars.SetDB(052, 0, 0200);
+        // Records spanning several zones, then many short ones
+        for (int k = 1; k <= 5; ++k) {
+            ASSERT_EQ(mars.putd(k, data, 3000), Mars::ERR_SUCCESS);
+        }
+        for (int k = 6; k <= 2000; ++k) {
+            ASSERT_EQ(mars.putd(k, data, k % 20), Mars::ERR_SUCCESS);
+        }
+        delete &mars;
+        EXPECT_EQ(scan(storage), 2000);
+        EXPECT_EQ(scan(storage, true), 2000);
+    }
+}
+
 TEST(mars, conditional)
 {
     Mars mars(false);
@@ -172,3 +342,54 @@ TEST(mars, conditional)
     EXPECT_EQ(mars.eval(Mars::OP_CHAIN), Mars::ERR_SUCCESS);
     EXPECT_EQ(mars.bdvect().loc4, 0xBADul);
 }
+
+TEST(mars, rangescan)
+{
+    Mars mars(false);
+    mars.storage = Mars::MEMORY;
+    mars.InitDB(052, 0, 0100);
+    mars.SetDB(052, 0, 0100);
+    uint64_t data[10];
+    for (uint64_t k = 10; k <= 3000; k += 10) {
+        std::fill(data, data + 10, k);
+        ASSERT_EQ(mars.putd(k, data, k % 7), Mars::ERR_SUCCESS);
+    }
+    uint64_t expect = 1000;
+    for (auto & [k, v] : mars.scan(995, 2000)) {
+        ASSERT_EQ(k, expect);
+        ASSERT_EQ(v.size(), k % 7);
+        ASSERT_TRUE(std::all_of(v.begin(), v.end(), [&](uint64_t w) { return w == k; }));
+        if (k == 1500) {
+            // Moves the cursor, the scan must resume after 1500
+            ASSERT_EQ(mars.getd(20, data, 10), Mars::ERR_SUCCESS);
+            ASSERT_EQ(mars.deld(1510), Mars::ERR_SUCCESS);
+            expect += 10;
+        }
+        expect += 10;
+    }
+    EXPECT_EQ(expect, 2000u);
+    EXPECT_EQ(mars.status, Mars::ERR_SUCCESS);
+
+    // Two scans at once, and an empty one
+    auto a = mars.scan(0), b = mars.scan(2995);
+    auto i = a.begin(), j = b.begin();
+    EXPECT_EQ(i->key, 10u);
+    EXPECT_EQ(j->key, 3000u);
+    ++i;
+    ++j;
+    EXPECT_EQ(i->key, 20u);
+    EXPECT_TRUE(j == b.end());
+    auto c = mars.scan(3001);
+    EXPECT_TRUE(c.begin() == c.end());
+
+    // A scan does not go on in another DB
+    auto d = mars.scan(0);
+    auto k = d.begin();
+    EXPECT_EQ(k->key, 10u);
+    mars.InitDB(053, 0, 0100);
+    mars.SetDB(053, 0, 0100);
+    ASSERT_EQ(mars.putd(20, data, 1), Mars::ERR_SUCCESS);
+    ++k;
+    EXPECT_TRUE(k == d.end());
+    EXPECT_EQ(mars.status, Mars::ERR_NO_CURR);
+}
@@ -26,6 +26,7 @@ void usage() {
       "\t-c\tDo not clear the DB at the end\n"
       "\t-d\tInclude date stamps in descriptors\n"
       "\t-t\tDump zones in text format as well\n"
+      "\t-T <f>\tDump zones in text format to a single file\n"
       ;
 }
 
@@ -52,7 +53,7 @@ int main(int argc, char ** argv) {
     mars.zero_date = true;
 
     for (;;) {
-        c = getopt (argc, argv, "inhVticdm:L:l:f:r:R:");
+        c = getopt (argc, argv, "inhVticdm:L:l:f:r:R:T:");
         if (c < 0)
             break;
         switch (c) {
@@ -72,6 +73,10 @@ int main(int argc, char ** argv) {
         case 't':
             mars.dump_txt_zones = true;
             break;
+        case 'T':
+            mars.dump_txt_zones = true;
+            mars.dump_file = optarg;
+            break;
         case 'd':
             mars.zero_date = false;
             break;
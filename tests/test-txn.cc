@@ -0,0 +1,190 @@
+#include <cstdio>
+#include <cstdlib>
+#include <format>
+#include <gtest/gtest.h>
+
+#include "fixture.h"
+#include "mars.h"
+
+static void fill(uint64_t *data, int len, uint64_t seed) {
+    for (int i = 0; i < len; ++i)
+        data[i] = seed * 1000 + i;
+}
+
+TEST(mars, rollback)
+{
+    Mars mars;
+    mars.storage = Mars::MEMORY;
+    uint64_t data[300], got[300];
+    mars.InitDB(0, 0, 0100);
+    mars.SetDB(0, 0, 0100);
+    for (int i = 1; i <= 200; ++i) {
+        fill(data, i, i);
+        ASSERT_EQ(mars.putd(i, data, i), Mars::ERR_SUCCESS);
+    }
+    int space = mars.avail();
+
+    ASSERT_EQ(mars.begin(), Mars::ERR_SUCCESS);
+    for (int i = 201; i <= 600; ++i) {
+        fill(data, i % 100, i);
+        ASSERT_EQ(mars.putd(i, data, i % 100), Mars::ERR_SUCCESS);
+    }
+    for (int i = 1; i <= 200; i += 2) {
+        ASSERT_EQ(mars.deld(i), Mars::ERR_SUCCESS);
+    }
+    for (int i = 2; i <= 200; i += 2) {
+        fill(data, 300 - i, 0);
+        ASSERT_EQ(mars.modd(i, data, 300 - i), Mars::ERR_SUCCESS);
+    }
+    ASSERT_EQ(mars.rollback(), Mars::ERR_SUCCESS);
+
+    EXPECT_EQ(mars.avail(), space);
+    EXPECT_EQ(mars.last(), 200u);
+    EXPECT_EQ(mars.getd(300, got, 300), Mars::ERR_NO_NAME);
+    for (int i = 1; i <= 200; ++i) {
+        fill(data, i, i);
+        ASSERT_EQ(mars.getd(i, got, i), Mars::ERR_SUCCESS);
+        ASSERT_EQ(mars.getlen(), i);
+        ASSERT_TRUE(std::equal(data, data + i, got)) << "key " << i;
+    }
+    // The DB remains usable
+    ASSERT_EQ(mars.putd(201, data, 10), Mars::ERR_SUCCESS);
+    EXPECT_EQ(mars.last(), 201u);
+}
+
+// Ingests records one call at a time or in transactions,
+// returns the checksums of the zones
+static std::string ingest(bool batched, const char * log = "")
+{
+    Mars & mars = *new Mars;
+    std::string result;
+    run_command(result, "rm -f 520[0-1]?? 52.redo");
+    mars.zero_date = true;
+    mars.redo_log = log;
+    mars.log_limit = 50000;
+    mars.InitDB(052, 0, 0200);
+    mars.SetDB(052, 0, 0200);
+    uint64_t data[500];
+    for (int i = 1; i <= 300; ++i) {
+        if (batched && i % 100 == 1)
+            mars.begin();
+        fill(data, i * 7 % 500, i);
+        EXPECT_EQ(mars.modd(i, data, i * 7 % 500), Mars::ERR_SUCCESS);
+        if (batched && i % 100 == 0) {
+            EXPECT_EQ(mars.commit(), Mars::ERR_SUCCESS);
+        }
+    }
+    if (batched) {
+        // The committed records are in the files already
+        Mars reader(false);
+        EXPECT_EQ(reader.SetDB(052, 0, 0200), Mars::ERR_SUCCESS);
+        EXPECT_EQ(reader.getd(300, data, 500), Mars::ERR_SUCCESS);
+        EXPECT_EQ(data[0], 300000u);
+    }
+    delete &mars;
+    run_command(result, "sha1sum 520[0-1]?? | sha1sum");
+    return result;
+}
+
+TEST(mars, commit)
+{
+    // Batching must not affect the images
+    EXPECT_EQ(ingest(true), ingest(false));
+}
+
+TEST(mars, redolog)
+{
+    // Logging must not affect the images, with or without checkpoints
+    std::string plain = ingest(false);
+    EXPECT_EQ(ingest(false, "52.redo"), plain);
+    EXPECT_EQ(ingest(true, "52.redo"), plain);
+}
+
+TEST(mars, recovery)
+{
+    std::string result;
+    run_command(result, "rm -f 520[0-1]?? 52.redo");
+    uint64_t data[500];
+    {
+        // The Mars is never destroyed, as if the process has crashed
+        Mars & mars = *new Mars;
+        mars.redo_log = "52.redo";
+        mars.InitDB(052, 0, 0200);
+        mars.SetDB(052, 0, 0200);
+        for (int i = 1; i <= 100; ++i) {
+            fill(data, i, i);
+            ASSERT_EQ(mars.putd(i, data, i), Mars::ERR_SUCCESS);
+        }
+        mars.begin();
+        for (int i = 101; i <= 200; ++i) {
+            fill(data, i, i);
+            ASSERT_EQ(mars.putd(i, data, i), Mars::ERR_SUCCESS);
+        }
+        mars.commit();
+        mars.begin();
+        ASSERT_EQ(mars.deld(1), Mars::ERR_SUCCESS);
+    }
+    {
+        // Then the log is replayed over the zone files, and the process crashes again
+        Mars & mars = *new Mars;
+        mars.redo_log = "52.redo";
+        ASSERT_EQ(mars.SetDB(052, 0, 0200), Mars::ERR_SUCCESS);
+        for (int i = 201; i <= 300; ++i) {
+            fill(data, i, i);
+            ASSERT_EQ(mars.putd(i, data, i), Mars::ERR_SUCCESS);
+        }
+    }
+    Mars mars;
+    mars.redo_log = "52.redo";
+    ASSERT_EQ(mars.SetDB(052, 0, 0200), Mars::ERR_SUCCESS);
+    uint64_t got[500];
+    for (int i = 1; i <= 300; ++i) {
+        fill(data, i, i);
+        ASSERT_EQ(mars.getd(i, got, i), Mars::ERR_SUCCESS) << "key " << i;
+        ASSERT_TRUE(std::equal(data, data + i, got)) << "key " << i;
+    }
+    EXPECT_EQ(mars.last(), 300u);
+}
+
+TEST(mars, lunrecovery)
+{
+    std::string result;
+    run_command(result, "rm -f 52.lun 52.redo");
+    uint64_t data[100];
+    {
+        Mars mars;
+        mars.storage = Mars::LUN_FILES;
+        mars.redo_log = "52.redo";
+        mars.InitDB(052, 0, 0200);
+    }
+    {
+        // The Mars is never destroyed, as if the process has crashed
+        Mars & mars = *new Mars;
+        mars.storage = Mars::LUN_FILES;
+        mars.redo_log = "52.redo";
+        mars.log_limit = 1 << 30;
+        mars.SetDB(052, 0, 0200);
+        for (int i = 1; i <= 100; ++i) {
+            fill(data, i, i);
+            ASSERT_EQ(mars.putd(i, data, i), Mars::ERR_SUCCESS);
+        }
+    }
+    {
+        // Until a checkpoint, the changes must be in the log only
+        Mars mars(false);
+        mars.storage = Mars::LUN_FILES;
+        ASSERT_EQ(mars.SetDB(052, 0, 0200), Mars::ERR_SUCCESS);
+        EXPECT_EQ(mars.last(), 0u);
+    }
+    Mars mars;
+    mars.storage = Mars::LUN_FILES;
+    mars.redo_log = "52.redo";
+    ASSERT_EQ(mars.SetDB(052, 0, 0200), Mars::ERR_SUCCESS);
+    uint64_t got[100];
+    for (int i = 1; i <= 100; ++i) {
+        fill(data, i, i);
+        ASSERT_EQ(mars.getd(i, got, i), Mars::ERR_SUCCESS) << "key " << i;
+        ASSERT_TRUE(std::equal(data, data + i, got)) << "key " << i;
+    }
+    EXPECT_EQ(mars.last(), 100u);
+}